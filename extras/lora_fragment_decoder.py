@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+#
+# This file is part of the Arduino_ConnectionHandler library.
+#
+# Copyright (c) 2024 Arduino SA
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# Reassemble the uplinks sent with LoRaConnectionHandler::sendFragmented(), or
+# split a message in downlinks for LoRaConnectionHandler::readMessage().
+#
+#   python3 lora_fragment_decoder.py uplinks.txt      (one hex payload per line)
+#   python3 lora_fragment_decoder.py --split 0011223344 --size 51
+#
+# Every fragment starts with a 4 bytes header:
+#   0xF0 | message id (4 bits), last flag (bit 7) | index (7 bits), offset (16 bits LE)
+
+import argparse
+import struct
+import sys
+
+MARKER = 0xF0
+HEADER = struct.Struct('<BBH')
+MAX_FRAGMENTS = 128
+
+
+class Reassembler:
+    def __init__(self):
+        self.reset(None)
+
+    def reset(self, msg_id):
+        self.msg_id = msg_id
+        self.chunks = {}
+        self.total = None
+
+    def feed(self, payload):
+        """Add a fragment, returns the message once complete, otherwise None."""
+        if len(payload) <= HEADER.size or (payload[0] & 0xF0) != MARKER:
+            raise ValueError('not a fragment')
+        first, second, offset = HEADER.unpack_from(payload)
+        msg_id = first & 0x0F
+        if msg_id != self.msg_id:
+            if self.chunks:
+                print('message %d incomplete, dropped' % self.msg_id, file=sys.stderr)
+            self.reset(msg_id)
+        data = payload[HEADER.size:]
+        self.chunks[offset] = data
+        if second & 0x80:
+            self.total = offset + len(data)
+        if self.total is not None and sum(len(c) for c in self.chunks.values()) == self.total:
+            message = bytearray(self.total)
+            for offset, data in self.chunks.items():
+                message[offset:offset + len(data)] = data
+            self.reset(None)
+            return bytes(message)
+        return None
+
+
+def fragment(data, size, msg_id=1):
+    """Split data in payloads of at most size bytes, header included."""
+    room = size - HEADER.size
+    count = (len(data) + room - 1) // room
+    if room <= 0 or count > MAX_FRAGMENTS:
+        raise ValueError('message too large for %d fragments' % MAX_FRAGMENTS)
+    payloads = []
+    for index in range(count):
+        offset = index * room
+        last = 0x80 if index == count - 1 else 0x00
+        payloads.append(HEADER.pack(MARKER | (msg_id & 0x0F), last | index, offset) + data[offset:offset + room])
+    return payloads
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Reassemble or split Arduino_ConnectionHandler LoRa fragments')
+    parser.add_argument('file', nargs='?', help='hex payloads, one per line (default: stdin)')
+    parser.add_argument('--split', metavar='HEX', help='split this message in downlink payloads')
+    parser.add_argument('--size', type=int, default=51, help='max payload size of a frame (default: 51)')
+    parser.add_argument('--id', type=int, default=1, help='message id used with --split (default: 1)')
+    args = parser.parse_args()
+
+    if args.split is not None:
+        for payload in fragment(bytes.fromhex(args.split), args.size, args.id):
+            print(payload.hex())
+        return
+
+    stream = open(args.file) if args.file else sys.stdin
+    reassembler = Reassembler()
+    for line in stream:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            message = reassembler.feed(bytes.fromhex(line))
+        except ValueError:
+            # Uplinks sent with send() are mixed with the fragments
+            print('not a fragment, skipped: %s' % line, file=sys.stderr)
+            continue
+        if message is not None:
+            print(message.hex())
+
+
+if __name__ == '__main__':
+    main()
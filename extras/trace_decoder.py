@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# This file is part of the Arduino_ConnectionHandler library.
+#
+# Copyright (c) 2024 Arduino SA
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# Decode the binary dump produced by TraceLog::dump().
+#
+#   python3 trace_decoder.py trace.bin
+#   python3 trace_decoder.py --port /dev/ttyACM0   (requires pyserial)
+#
+# With --port the tool waits for the dump on the serial port, the sketch is
+# expected to call TraceLog::instance().dump(Serial) e.g. on a key press.
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x52544843  # "CHTR"
+HEADER = struct.Struct('<IBBHI')
+RECORD = struct.Struct('<IBBBBi')
+
+ADAPTERS = ['NONE', 'WIFI', 'ETHERNET', 'NB', 'GSM', 'LORA', 'CATM1', 'CELL']
+STATES = ['INIT', 'CONNECTING', 'CONNECTED', 'DISCONNECTING', 'DISCONNECTED', 'CLOSED', 'ERROR']
+EVENTS = ['TRANSITION', 'CONNECT', 'DISCONNECT', 'BEGIN', 'STATUS', 'PING', 'ATTACH', 'JOIN', 'END', 'FAILURE', 'SCAN']
+
+
+def name(table, value):
+    return table[value] if value < len(table) else str(value)
+
+
+def read_exact(stream, size):
+    data = b''
+    while len(data) < size:
+        chunk = stream.read(size - len(data))
+        if not chunk:
+            raise EOFError('truncated trace dump')
+        data += chunk
+    return data
+
+
+def sync(stream):
+    """Skip anything preceding the magic, e.g. debug output on the same port."""
+    window = b''
+    magic = struct.pack('<I', MAGIC)
+    while window != magic:
+        byte = stream.read(1)
+        if not byte:
+            raise EOFError('no trace dump found')
+        window = (window + byte)[-4:]
+    return magic
+
+
+def decode(stream, out):
+    header = sync(stream) + read_exact(stream, HEADER.size - 4)
+    _, version, record_size, count, written = HEADER.unpack(header)
+    if version != 1 or record_size != RECORD.size:
+        raise ValueError('unsupported trace dump: version %d, record size %d' % (version, record_size))
+
+    lost = written - count
+    out.write('%d records%s\n' % (count, ' (%d older records overwritten)' % lost if lost > 0 else ''))
+
+    previous = None
+    for _ in range(count):
+        timestamp, adapter, state, event, _, arg = RECORD.unpack(read_exact(stream, RECORD.size))
+        delta = '' if previous is None else '+%d' % ((timestamp - previous) & 0xFFFFFFFF)
+        previous = timestamp
+
+        event_name = name(EVENTS, event)
+        if event_name == 'TRANSITION':
+            detail = '-> %s' % name(STATES, arg)
+        elif event_name in ('CONNECT', 'DISCONNECT', 'END'):
+            detail = ''
+        else:
+            detail = '%d' % arg
+
+        line = '%10d %8s  %-8s %-13s %-10s %s' % (
+            timestamp, delta, name(ADAPTERS, adapter), name(STATES, state), event_name, detail)
+        out.write(line.rstrip() + '\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode an Arduino_ConnectionHandler trace dump')
+    parser.add_argument('file', nargs='?', help='binary dump, stdin if omitted')
+    parser.add_argument('--port', help='read the dump from a serial port')
+    parser.add_argument('--baud', type=int, default=115200)
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        stream = serial.Serial(args.port, args.baud)
+    elif args.file:
+        stream = open(args.file, 'rb')
+    else:
+        stream = sys.stdin.buffer
+
+    try:
+        decode(stream, sys.stdout)
+    except (EOFError, ValueError) as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()
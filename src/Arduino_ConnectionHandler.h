@@ -50,4 +50,8 @@
   #include "CellularConnectionHandler.h"
 #endif
 
+#if defined(BOARD_HAS_RTOS)
+  #include "ConnectionHandlerThread.h"
+#endif
+
 #endif /* CONNECTION_HANDLER_H_ */
@@ -16,13 +16,17 @@
 
 #ifdef BOARD_HAS_CATM1_NBIOT /* Only compile if the board has CatM1 BN-IoT */
 #include "CatM1ConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
   CTOR/DTOR
  ******************************************************************************/
 
 CatM1ConnectionHandler::CatM1ConnectionHandler()
-: ConnectionHandler(true, NetworkAdapter::CATM1) { }
+: ConnectionHandler(true, NetworkAdapter::CATM1) {
+  _client_pool = &_gsm_client_pool;
+  _udp_pool = &_gsm_udp_pool;
+}
 
 CatM1ConnectionHandler::CatM1ConnectionHandler(
   const char * pin, const char * apn, const char * login, const char * pass,
@@ -30,6 +34,8 @@ CatM1ConnectionHandler::CatM1ConnectionHandler(
 : ConnectionHandler{keep_alive, NetworkAdapter::CATM1}
 {
   _settings.type = NetworkAdapter::CATM1;
+  _client_pool = &_gsm_client_pool;
+  _udp_pool = &_gsm_udp_pool;
   // To keep the backward compatibility, the user can call enableCheckInternetAvailability(false) for disabling the check
   _check_internet_availability = true;
   strncpy(_settings.catm1.pin, pin, sizeof(_settings.catm1.pin)-1);
@@ -54,15 +60,19 @@ unsigned long CatM1ConnectionHandler::getTime()
 }
 
 int CatM1ConnectionHandler::ping(IPAddress ip, uint8_t ttl, uint8_t count) {
-  return GSM.ping(ip);
+  return GSM.ping(ip, ttl);
 }
 
 int CatM1ConnectionHandler::ping(const String &hostname, uint8_t ttl, uint8_t count) {
-  return GSM.ping(hostname);
+  return ping(hostname.c_str(), ttl, count);
 }
 
 int CatM1ConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count) {
-  return GSM.ping(host);
+  IPAddress ip;
+  if (resolve(host, ip) == 1) {
+    return GSM.ping(ip, ttl);
+  }
+  return GSM.ping(host, ttl);
 }
 
 
@@ -70,6 +80,19 @@ int CatM1ConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count) {
   PROTECTED MEMBER FUNCTIONS
  ******************************************************************************/
 
+int CatM1ConnectionHandler::icmpRTT(IPAddress const & ip)
+{
+  return GSM.ping(ip);
+}
+
+int CatM1ConnectionHandler::hostByName(const char * host, IPAddress & ip, IPFamily const family)
+{
+  if (family == IPFamily::IPV6) {
+    return mbed_host_by_name(GSM.getNetwork(), host, ip, family);
+  }
+  return GSM.hostByName(host, ip) == 1 ? 1 : 0;
+}
+
 NetworkConnectionState CatM1ConnectionHandler::update_handleInit()
 {
 #if defined (ARDUINO_EDGE_CONTROL)
@@ -78,6 +101,7 @@ NetworkConnectionState CatM1ConnectionHandler::update_handleInit()
   digitalWrite(ON_MKR2, HIGH);
 #endif
 
+  _profiles.apply(_settings.catm1);
   if(!GSM.begin(
     _settings.catm1.pin,
     _settings.catm1.apn,
@@ -87,10 +111,15 @@ NetworkConnectionState CatM1ConnectionHandler::update_handleInit()
     _settings.catm1.band,
     _reset))
   {
+    trace(TraceEvent::BEGIN, 0);
     DEBUG_ERROR(F("The board was not able to register to the network..."));
     _reset = true;
+    /* Retried forever as before, rotating through the profiles if any */
+    _profiles.next();
     return NetworkConnectionState::DISCONNECTED;
   }
+  trace(TraceEvent::BEGIN, 1);
+  _profiles.connected();
   _reset = false;
   return NetworkConnectionState::CONNECTING;
 }
@@ -99,6 +128,7 @@ NetworkConnectionState CatM1ConnectionHandler::update_handleConnecting()
 {
   if (!GSM.isConnected())
   {
+    trace(TraceEvent::STATUS, 0);
     DEBUG_ERROR(F("GSM connection not alive... disconnecting"));
     return NetworkConnectionState::DISCONNECTED;
   }
@@ -109,6 +139,7 @@ NetworkConnectionState CatM1ConnectionHandler::update_handleConnecting()
 
   DEBUG_INFO(F("Sending PING to outer space..."));
   int const ping_result = ping("time.arduino.cc");
+  trace(TraceEvent::PING, ping_result);
   DEBUG_INFO(F("GSM.ping(): %d"), ping_result);
   if (ping_result < 0)
   {
@@ -128,6 +159,7 @@ NetworkConnectionState CatM1ConnectionHandler::update_handleConnected()
   int const is_gsm_access_alive = GSM.isConnected();
   if (is_gsm_access_alive != 1)
   {
+    trace(TraceEvent::STATUS, is_gsm_access_alive);
     DEBUG_ERROR(F("GSM connection not alive... disconnecting"));
     return NetworkConnectionState::DISCONNECTED;
   }
@@ -143,6 +175,7 @@ NetworkConnectionState CatM1ConnectionHandler::update_handleDisconnecting()
 NetworkConnectionState CatM1ConnectionHandler::update_handleDisconnected()
 {
   GSM.end();
+  trace(TraceEvent::END);
   if (_keep_alive)
   {
     return NetworkConnectionState::INIT;
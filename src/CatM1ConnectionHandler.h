@@ -16,6 +16,7 @@
  ******************************************************************************/
 
 #include "ConnectionHandlerInterface.h"
+#include "ConnectionHandlerCellularProfiles.h"
 
 #if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_EDGE_CONTROL)
   #include <GSM.h>
@@ -44,8 +45,14 @@ class CatM1ConnectionHandler : public ConnectionHandler
     virtual Client & getClient() override { return _gsm_client; };
     virtual UDP & getUDP() override { return _gsm_udp; };
 
+    /* Fallback PIN/APN/SIM profiles, used in place of the settings when any is added */
+    inline CellularProfileList & getProfiles() { return _profiles; }
+
   protected:
 
+    virtual int hostByName(const char * host, IPAddress & ip, IPFamily const family) override;
+    virtual int icmpRTT(IPAddress const & ip) override;
+
     virtual NetworkConnectionState update_handleInit         () override;
     virtual NetworkConnectionState update_handleConnecting   () override;
     virtual NetworkConnectionState update_handleConnected    () override;
@@ -55,10 +62,15 @@ class CatM1ConnectionHandler : public ConnectionHandler
 
   private:
 
+    CellularProfileList _profiles;
+
     bool _reset;
 
     GSMUDP _gsm_udp;
     GSMClient _gsm_client;
+
+    SocketPool<Client, GSMClient, CONNECTION_HANDLER_CLIENT_POOL_SIZE> _gsm_client_pool;
+    SocketPool<UDP, GSMUDP, CONNECTION_HANDLER_UDP_POOL_SIZE> _gsm_udp_pool;
 };
 
 #endif /* #ifndef ARDUINO_CATM1_CONNECTION_HANDLER_H_ */
@@ -17,6 +17,7 @@
 
 #ifdef BOARD_HAS_CELLULAR /* Only compile if the board has Cellular */
 #include "CellularConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
   CTOR/DTOR
@@ -44,22 +45,26 @@ unsigned long CellularConnectionHandler::getTime()
   return _cellular.getCellularTime().getUNIXTimestamp();
 }
 
+/* The modem has no ICMP echo: the time to open a TCP connection to port 443 is
+ * returned instead, in ms, or -1 if no probe got an answer.
+ */
 int CellularConnectionHandler::ping(IPAddress ip, uint8_t ttl, uint8_t count) {
-  return 0;
+  (void)ttl;
+  int rtt = -1;
+  for (uint8_t i = 0; i < count && rtt < 0; i++) {
+    rtt = tcpRTT(nullptr, ip, 443);
+  }
+  return rtt;
 }
 
 int CellularConnectionHandler::ping(const String &hostname, uint8_t ttl, uint8_t count) {
-  return 0;
+  return ping(hostname.c_str(), ttl, count);
 }
 
 int CellularConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count) {
-  return 0;
-}
-
-UDP & CellularConnectionHandler::getUDP()
-{
-  DEBUG_ERROR(F("CellularConnectionHandler has no UDP support"));
-  while(1) {};
+  (void)ttl;
+  RTTStats const stats = measureRTT(host, count);
+  return stats.received > 0 ? static_cast<int>(stats.avg) : -1;
 }
 
 /******************************************************************************
@@ -68,17 +73,22 @@ UDP & CellularConnectionHandler::getUDP()
 
 NetworkConnectionState CellularConnectionHandler::update_handleInit()
 {
+  _profiles.apply(_settings.cell);
   _cellular.begin();
   _cellular.setDebugStream(Serial);
   if (strlen(_settings.cell.pin) > 0 && !_cellular.unlockSIM(_settings.cell.pin)) {
+    trace(TraceEvent::FAILURE);
     DEBUG_ERROR(F("SIM not present or wrong PIN"));
-    return NetworkConnectionState::ERROR;
+    return _profiles.next() ? NetworkConnectionState::INIT : NetworkConnectionState::ERROR;
   }
 
   if (!_cellular.connect(String(_settings.cell.apn), String(_settings.cell.login), String(_settings.cell.pass))) {
+    trace(TraceEvent::ATTACH, 0);
     DEBUG_ERROR(F("The board was not able to register to the network..."));
-    return NetworkConnectionState::ERROR;
+    return _profiles.next() ? NetworkConnectionState::INIT : NetworkConnectionState::ERROR;
   }
+  trace(TraceEvent::ATTACH, 1);
+  _profiles.connected();
   DEBUG_INFO(F("Connected to Network"));
   return NetworkConnectionState::CONNECTING;
 }
@@ -94,6 +104,7 @@ NetworkConnectionState CellularConnectionHandler::update_handleConnecting()
   }
 
   if(getTime() == 0){
+    trace(TraceEvent::PING, 0);
     DEBUG_ERROR(F("Internet check failed"));
     DEBUG_INFO(F("Retrying in  \"%d\" milliseconds"), _timeoutTable.timeout.connecting);
     return NetworkConnectionState::CONNECTING;
@@ -105,6 +116,7 @@ NetworkConnectionState CellularConnectionHandler::update_handleConnecting()
 NetworkConnectionState CellularConnectionHandler::update_handleConnected()
 {
   if (!_cellular.isConnectedToInternet()) {
+    trace(TraceEvent::STATUS, 0);
     return NetworkConnectionState::DISCONNECTED;
   }
   return NetworkConnectionState::CONNECTED;
@@ -117,6 +129,9 @@ NetworkConnectionState CellularConnectionHandler::update_handleDisconnecting()
 
 NetworkConnectionState CellularConnectionHandler::update_handleDisconnected()
 {
+  /* The modem sockets don't survive the connection loss */
+  _udp.stop();
+
   if (_keep_alive) {
     return NetworkConnectionState::INIT;
   }
@@ -17,6 +17,8 @@
  ******************************************************************************/
 
 #include "ConnectionHandlerInterface.h"
+#include "ConnectionHandlerCellularProfiles.h"
+#include "ConnectionHandlerCellularUDP.h"
 
 #if defined(ARDUINO_PORTENTA_C33) || defined(ARDUINO_PORTENTA_H7_M7)
 #include <Arduino_Cellular.h>
@@ -42,7 +44,10 @@ class CellularConnectionHandler : public ConnectionHandler
 
     virtual unsigned long getTime() override;
     virtual Client & getClient() override { return _gsm_client; };
-    virtual UDP & getUDP() override;
+    virtual UDP & getUDP() override { return _udp; };
+
+    /* Fallback PIN/APN/SIM profiles, used in place of the settings when any is added */
+    inline CellularProfileList & getProfiles() { return _profiles; }
 
   protected:
 
@@ -55,8 +60,11 @@ class CellularConnectionHandler : public ConnectionHandler
 
   private:
 
+    CellularProfileList _profiles;
+
     ArduinoCellular _cellular;
     TinyGsmClient _gsm_client = _cellular.getNetworkClient();
+    CellularUDP _udp{_cellular};
 };
 
 #endif /* #ifndef ARDUINO_CELLULAR_CONNECTION_HANDLER_H_ */
@@ -0,0 +1,135 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerCellularProfiles.h"
+
+#if defined(BOARD_HAS_NB) || defined(BOARD_HAS_GSM) || defined(BOARD_HAS_CELLULAR) || defined(BOARD_HAS_CATM1_NBIOT)
+#include "ConnectionHandlerDebug.h"
+
+/******************************************************************************
+  FUNCTION DEFINITION
+ ******************************************************************************/
+
+__attribute__((weak)) bool cellular_select_sim(uint8_t const slot)
+{
+  /* This function can be overwritten by a "strong" implementation
+   * in a higher level application, driving the SIM switch of the board.
+   */
+  return slot == 0;
+}
+
+/******************************************************************************
+  CTOR/DTOR
+ ******************************************************************************/
+
+CellularProfileList::CellularProfileList()
+: _count{0}
+, _current{0}
+, _failures{0}
+, _last_good{-1}
+, _sim{-1}
+, _on_connected{nullptr}
+{
+
+}
+
+/******************************************************************************
+  PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+
+bool CellularProfileList::add(const char * pin, const char * apn, const char * login, const char * pass, uint8_t const sim)
+{
+  if (_count >= CONNECTION_HANDLER_CELLULAR_MAX_PROFILES) {
+    return false;
+  }
+
+  models::CellularProfile & profile = _profiles[_count];
+  memset(&profile, 0, sizeof(profile));
+  strncpy(profile.pin, pin, sizeof(profile.pin)-1);
+  strncpy(profile.apn, apn, sizeof(profile.apn)-1);
+  strncpy(profile.login, login, sizeof(profile.login)-1);
+  strncpy(profile.pass, pass, sizeof(profile.pass)-1);
+  profile.sim = sim;
+  _count++;
+  return true;
+}
+
+void CellularProfileList::clear()
+{
+  _count = 0;
+  _current = 0;
+  _failures = 0;
+  _last_good = -1;
+}
+
+bool CellularProfileList::setPreferred(uint8_t const index)
+{
+  if (index >= _count) {
+    return false;
+  }
+
+  _current = index;
+  _failures = 0;
+  _last_good = index;
+  return true;
+}
+
+bool CellularProfileList::next()
+{
+  if (_count == 0) {
+    return false;
+  }
+
+  _current = (_current + 1) % _count;
+  if (++_failures < _count) {
+    DEBUG_INFO(F("Trying cellular profile %d, APN \"%s\""), static_cast<int>(_current), _profiles[_current].apn);
+    return true;
+  }
+
+  _failures = 0;
+  return false;
+}
+
+void CellularProfileList::connected()
+{
+  _failures = 0;
+  if (_last_good == static_cast<int>(_current)) {
+    return;
+  }
+
+  _last_good = _current;
+  if (_on_connected) {
+    _on_connected(_current);
+  }
+}
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+void CellularProfileList::selectSim()
+{
+  uint8_t const slot = _profiles[_current].sim;
+  if (_sim == slot) {
+    return;
+  }
+
+  if (cellular_select_sim(slot)) {
+    _sim = slot;
+  } else {
+    DEBUG_ERROR(F("SIM slot %d not available"), slot);
+  }
+}
+
+#endif /* BOARD_HAS_NB || BOARD_HAS_GSM || BOARD_HAS_CELLULAR || BOARD_HAS_CATM1_NBIOT */
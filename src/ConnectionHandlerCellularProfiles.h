@@ -0,0 +1,108 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "ConnectionHandlerDefinitions.h"
+#include "connectionHandlerModels/settings.h"
+
+#if defined(BOARD_HAS_NB) || defined(BOARD_HAS_GSM) || defined(BOARD_HAS_CELLULAR) || defined(BOARD_HAS_CATM1_NBIOT)
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#ifndef CONNECTION_HANDLER_CELLULAR_MAX_PROFILES
+  #define CONNECTION_HANDLER_CELLULAR_MAX_PROFILES 3
+#endif
+
+/******************************************************************************
+  FUNCTION DECLARATION
+ ******************************************************************************/
+
+/* Route the modem to the given SIM slot, returns false if the slot is not
+ * available. The default implementation only accepts slot 0: boards with a
+ * SIM switch provide a "strong" implementation in the application.
+ */
+bool cellular_select_sim(uint8_t const slot);
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** CellularProfileList class
+ * An ordered list of PIN/APN/credentials sets, each one bound to a SIM slot,
+ * used by the cellular handlers in place of the single set of their settings.
+ * A failed SIM unlock or attach moves the handler on to the next profile, the
+ * one which attached is kept for the next reconnections. The callback lets the
+ * application store its index, to be restored with setPreferred() at boot so
+ * that the first attach goes straight to the working profile.
+ */
+class CellularProfileList
+{
+  public:
+
+    typedef void (*OnProfileConnected)(uint8_t const index);
+
+    CellularProfileList();
+
+    bool add(const char * pin, const char * apn, const char * login, const char * pass, uint8_t const sim = 0);
+    void clear();
+    bool setPreferred(uint8_t const index);
+    inline void setCallback(OnProfileConnected callback) { _on_connected = callback; }
+
+    inline size_t count() const { return _count; }
+    /* Index of the profile in use, -1 if the list is empty */
+    inline int current() const { return _count > 0 ? _current : -1; }
+    inline models::CellularProfile const & get(size_t const index) const { return _profiles[index]; }
+
+    /* Used by the handlers: copy the current profile into their settings, switching
+     * the SIM slot when needed. Returns false, leaving the settings untouched, if
+     * the list is empty.
+     */
+    template <typename T>
+    bool apply(T & setting) {
+      if (_count == 0) {
+        return false;
+      }
+      selectSim();
+      models::CellularProfile const & profile = _profiles[_current];
+      memcpy(setting.pin, profile.pin, sizeof(setting.pin));
+      memcpy(setting.apn, profile.apn, sizeof(setting.apn));
+      memcpy(setting.login, profile.login, sizeof(setting.login));
+      memcpy(setting.pass, profile.pass, sizeof(setting.pass));
+      return true;
+    }
+
+    /* Move on to the next profile after a failure, returns false once every
+     * profile has failed in a row, or if the list is empty.
+     */
+    bool next();
+    void connected();
+
+  private:
+
+    void selectSim();
+
+    models::CellularProfile _profiles[CONNECTION_HANDLER_CELLULAR_MAX_PROFILES];
+    size_t _count;
+    size_t _current;
+    size_t _failures;
+    int _last_good;
+    int _sim;
+    OnProfileConnected _on_connected;
+};
+
+#endif /* BOARD_HAS_NB || BOARD_HAS_GSM || BOARD_HAS_CELLULAR || BOARD_HAS_CATM1_NBIOT */
@@ -0,0 +1,338 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerCellularUDP.h"
+
+#if defined(BOARD_HAS_CELLULAR)
+#include "ConnectionHandlerDebug.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+static unsigned long const CELLULAR_UDP_TIMEOUT = 5000;
+/* The result of AT+QIOPEN is reported later by the +QIOPEN URC */
+static unsigned long const CELLULAR_UDP_OPEN_TIMEOUT = 10000;
+static int const CELLULAR_UDP_STATE_CONNECTED = 2;
+
+/******************************************************************************
+  LOCAL MODULE FUNCTIONS
+ ******************************************************************************/
+
+static void close_socket(ArduinoCellular & cellular)
+{
+  char command[24];
+  snprintf(command, sizeof(command), "+QICLOSE=%d", CONNECTION_HANDLER_CELLULAR_UDP_SOCKET);
+  cellular.sendATCommand(command, CELLULAR_UDP_TIMEOUT);
+}
+
+/* Value of a hex digit, -1 if it is not one */
+static int hex_value(char const c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+/* Result of the +QIOPEN: <id>,<err> URC if the response holds it, -1 otherwise */
+static int open_result(String const & response)
+{
+  char urc[20];
+  snprintf(urc, sizeof(urc), "+QIOPEN: %d,", CONNECTION_HANDLER_CELLULAR_UDP_SOCKET);
+  int const pos = response.indexOf(urc);
+  if (pos < 0) {
+    return -1;
+  }
+  return response.substring(pos + strlen(urc)).toInt();
+}
+
+/* Socket state from +QISTATE: <id>,"UDP","<host>",<port>,<local port>,<state>,... or -1 */
+static int socket_state(ArduinoCellular & cellular, String & response)
+{
+  char command[24];
+  snprintf(command, sizeof(command), "+QISTATE=1,%d", CONNECTION_HANDLER_CELLULAR_UDP_SOCKET);
+  response = cellular.sendATCommand(command, CELLULAR_UDP_TIMEOUT);
+
+  int pos = response.indexOf("+QISTATE:");
+  if (pos < 0) {
+    return -1;
+  }
+  for (int field = 0; field < 5; field++) {
+    pos = response.indexOf(',', pos + 1);
+    if (pos < 0) {
+      return -1;
+    }
+  }
+  return response.substring(pos + 1).toInt();
+}
+
+/******************************************************************************
+  CTOR/DTOR
+ ******************************************************************************/
+
+CellularUDP::CellularUDP(ArduinoCellular & cellular)
+: _cellular{cellular}
+, _local_port{0}
+, _open{false}
+, _remote_port{0}
+, _tx_port{0}
+, _tx_size{0}
+, _rx_size{0}
+, _rx_pos{0}
+{
+  _remote_host[0] = '\0';
+  _tx_host[0] = '\0';
+  _tx_prefix = snprintf(_tx_command, CELLULAR_UDP_SEND_PREFIX, "+QISENDEX=%d,\"", CONNECTION_HANDLER_CELLULAR_UDP_SOCKET);
+}
+
+/******************************************************************************
+  PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+
+uint8_t CellularUDP::begin(uint16_t port)
+{
+  /* The socket is opened by the first endPacket(), when the remote is known */
+  stop();
+  _local_port = port;
+  return 1;
+}
+
+void CellularUDP::stop()
+{
+  if (_open) {
+    close_socket(_cellular);
+    _open = false;
+  }
+  _remote_host[0] = '\0';
+  _remote_port = 0;
+  _tx_size = 0;
+  _rx_size = 0;
+  _rx_pos = 0;
+}
+
+int CellularUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+  char host[16];
+  snprintf(host, sizeof(host), "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+  return beginPacket(host, port);
+}
+
+int CellularUDP::beginPacket(const char * host, uint16_t port)
+{
+  if (strlen(host) >= sizeof(_tx_host)) {
+    return 0;
+  }
+
+  strcpy(_tx_host, host);
+  _tx_port = port;
+  _tx_size = 0;
+  return 1;
+}
+
+int CellularUDP::endPacket()
+{
+  if (_tx_port == 0) {
+    return 0;
+  }
+
+  if (!_open || _tx_port != _remote_port || strcmp(_tx_host, _remote_host) != 0) {
+    if (!open(_tx_host, _tx_port)) {
+      return 0;
+    }
+  }
+
+  /* AT+QISENDEX=<id>,"<hex>" */
+  size_t const end = _tx_prefix + 2 * _tx_size;
+  _tx_command[end] = '"';
+  _tx_command[end + 1] = '\0';
+
+  _tx_port = 0;
+  String const response = _cellular.sendATCommand(_tx_command, CELLULAR_UDP_TIMEOUT);
+  if (response.indexOf("SEND OK") < 0) {
+    DEBUG_ERROR(F("UDP send of %d bytes failed"), _tx_size);
+    /* The socket may be gone, it's opened again by the next endPacket() */
+    close_socket(_cellular);
+    _open = false;
+    return 0;
+  }
+  return 1;
+}
+
+size_t CellularUDP::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t CellularUDP::write(const uint8_t * buf, size_t size)
+{
+  static char const HEX_DIGITS[] = "0123456789ABCDEF";
+
+  size_t const room = CONNECTION_HANDLER_CELLULAR_UDP_BUFFER_SIZE - _tx_size;
+  size_t const written = size < room ? size : room;
+  char * hex = &_tx_command[_tx_prefix + 2 * _tx_size];
+  for (size_t i = 0; i < written; i++) {
+    *hex++ = HEX_DIGITS[buf[i] >> 4];
+    *hex++ = HEX_DIGITS[buf[i] & 0x0F];
+  }
+  _tx_size += written;
+  return written;
+}
+
+int CellularUDP::parsePacket()
+{
+  /* The rest of the previous datagram is discarded, as on the other UDP implementations */
+  _rx_size = 0;
+  _rx_pos = 0;
+
+  if (!_open) {
+    return 0;
+  }
+
+  /* The responses go through TinyGSM, which drops the bytes read as a negative
+   * or null char: the data is received hex encoded, +QIRD: <length>\r\n<hex data>.
+   * The receive format is global, it is restored for the sockets of TinyGSM.
+   */
+  char command[32];
+  snprintf(command, sizeof(command), "+QIRD=%d,%d", CONNECTION_HANDLER_CELLULAR_UDP_SOCKET, CONNECTION_HANDLER_CELLULAR_UDP_BUFFER_SIZE);
+  _cellular.sendATCommand("+QICFG=\"dataformat\",0,1", CELLULAR_UDP_TIMEOUT);
+  String const response = _cellular.sendATCommand(command, CELLULAR_UDP_TIMEOUT);
+  _cellular.sendATCommand("+QICFG=\"dataformat\",0,0", CELLULAR_UDP_TIMEOUT);
+
+  int const header = response.indexOf("+QIRD:");
+  if (header < 0) {
+    return 0;
+  }
+  long const length = response.substring(header + 6).toInt();
+  int const data = response.indexOf('\n', header);
+  if (length <= 0 || data < 0) {
+    return 0;
+  }
+
+  size_t const size = static_cast<size_t>(length) < sizeof(_rx_buffer) ? length : sizeof(_rx_buffer);
+  const char * hex = response.c_str() + data + 1;
+  for (_rx_size = 0; _rx_size < size; _rx_size++) {
+    int const high = hex_value(hex[2 * _rx_size]);
+    int const low = high < 0 ? -1 : hex_value(hex[2 * _rx_size + 1]);
+    if (low < 0) {
+      DEBUG_ERROR(F("UDP datagram of %ld bytes truncated to %d"), length, _rx_size);
+      break;
+    }
+    _rx_buffer[_rx_size] = static_cast<uint8_t>((high << 4) | low);
+  }
+  return _rx_size;
+}
+
+int CellularUDP::available()
+{
+  return _rx_size - _rx_pos;
+}
+
+int CellularUDP::read()
+{
+  return _rx_pos < _rx_size ? _rx_buffer[_rx_pos++] : -1;
+}
+
+int CellularUDP::read(unsigned char * buf, size_t size)
+{
+  size_t const left = _rx_size - _rx_pos;
+  size_t const copied = size < left ? size : left;
+  memcpy(buf, &_rx_buffer[_rx_pos], copied);
+  _rx_pos += copied;
+  return copied;
+}
+
+int CellularUDP::read(char * buf, size_t size)
+{
+  return read(reinterpret_cast<unsigned char *>(buf), size);
+}
+
+int CellularUDP::peek()
+{
+  return _rx_pos < _rx_size ? _rx_buffer[_rx_pos] : -1;
+}
+
+void CellularUDP::flush()
+{
+
+}
+
+IPAddress CellularUDP::remoteIP()
+{
+  IPAddress ip;
+  /* Hostnames are resolved by the modem, the address is known only if given as such */
+  if (!ip.fromString(_remote_host)) {
+    return IPAddress(0, 0, 0, 0);
+  }
+  return ip;
+}
+
+uint16_t CellularUDP::remotePort()
+{
+  return _remote_port;
+}
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+bool CellularUDP::open(const char * host, uint16_t const port)
+{
+  if (_open) {
+    close_socket(_cellular);
+    _open = false;
+  }
+
+  /* AT+QIOPEN=<context>,<id>,"UDP","<host>",<remote port>,<local port>,<buffer access mode> */
+  char command[48 + CELLULAR_UDP_HOST_LENGTH];
+  snprintf(command, sizeof(command), "+QIOPEN=1,%d,\"UDP\",\"%s\",%u,%u,0",
+           CONNECTION_HANDLER_CELLULAR_UDP_SOCKET, host, port, _local_port);
+  String response = _cellular.sendATCommand(command, CELLULAR_UDP_TIMEOUT);
+  if (response.indexOf("ERROR") >= 0) {
+    DEBUG_ERROR(F("UDP socket to %s:%d not opened"), host, port);
+    return false;
+  }
+
+  /* OK only means the command was accepted: wait for the URC, or for the socket
+   * state if the URC was consumed with the response of another command.
+   */
+  unsigned long const start = millis();
+  int result = open_result(response);
+  while (result < 0) {
+    if (socket_state(_cellular, response) == CELLULAR_UDP_STATE_CONNECTED) {
+      result = 0;
+      break;
+    }
+    result = open_result(response);
+    if (result < 0 && (millis() - start) >= CELLULAR_UDP_OPEN_TIMEOUT) {
+      break;
+    }
+    if (result < 0) {
+      delay(100);
+    }
+  }
+
+  if (result != 0) {
+    DEBUG_ERROR(F("UDP socket to %s:%d not opened: %d"), host, port, result);
+    close_socket(_cellular);
+    return false;
+  }
+
+  strcpy(_remote_host, host);
+  _remote_port = port;
+  _open = true;
+  return true;
+}
+
+#endif /* BOARD_HAS_CELLULAR */
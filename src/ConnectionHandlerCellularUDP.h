@@ -0,0 +1,98 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include "ConnectionHandlerDefinitions.h"
+
+#if defined(BOARD_HAS_CELLULAR)
+#include <Arduino_Cellular.h>
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+/* Largest datagram sent or received, the modem reads at most 1500 bytes at once */
+#ifndef CONNECTION_HANDLER_CELLULAR_UDP_BUFFER_SIZE
+  #define CONNECTION_HANDLER_CELLULAR_UDP_BUFFER_SIZE 512
+#endif
+
+/* Modem socket used by CellularUDP, TinyGSM allocates its clients from 0 */
+#ifndef CONNECTION_HANDLER_CELLULAR_UDP_SOCKET
+  #define CONNECTION_HANDLER_CELLULAR_UDP_SOCKET 11
+#endif
+
+#define CELLULAR_UDP_HOST_LENGTH 64
+#define CELLULAR_UDP_SEND_PREFIX 16   /* +QISENDEX=<id>," */
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** CellularUDP class
+ * UDP over the socket commands of the Quectel modem driven by Arduino_Cellular.
+ * The socket is bound to the remote of the packet being sent, it is reopened
+ * when the remote changes: datagrams are received from that remote only, which
+ * covers request/response protocols such as NTP or CoAP. Datagrams are sent hex
+ * encoded with AT+QISENDEX and read back hex encoded with AT+QIRD, the receive
+ * data format of the sockets used by TinyGSM is restored after each read.
+ */
+class CellularUDP : public UDP
+{
+  public:
+    CellularUDP(ArduinoCellular & cellular);
+
+    uint8_t begin(uint16_t port) override;
+    void stop() override;
+
+    int beginPacket(IPAddress ip, uint16_t port) override;
+    int beginPacket(const char * host, uint16_t port) override;
+    int endPacket() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t * buf, size_t size) override;
+
+    int parsePacket() override;
+    int available() override;
+    int read() override;
+    int read(unsigned char * buf, size_t size) override;
+    int read(char * buf, size_t size) override;
+    int peek() override;
+    void flush() override;
+
+    IPAddress remoteIP() override;
+    uint16_t remotePort() override;
+
+  private:
+
+    bool open(const char * host, uint16_t const port);
+
+    ArduinoCellular & _cellular;
+    uint16_t _local_port;
+    bool _open;
+
+    char _remote_host[CELLULAR_UDP_HOST_LENGTH];
+    uint16_t _remote_port;
+    char _tx_host[CELLULAR_UDP_HOST_LENGTH];
+    uint16_t _tx_port;
+
+    /* The datagram is hex encoded in place, right after the command prefix */
+    char _tx_command[CELLULAR_UDP_SEND_PREFIX + 2 * CONNECTION_HANDLER_CELLULAR_UDP_BUFFER_SIZE + 2];
+    size_t _tx_prefix;
+    size_t _tx_size;
+    uint8_t _rx_buffer[CONNECTION_HANDLER_CELLULAR_UDP_BUFFER_SIZE];
+    size_t _rx_size;
+    size_t _rx_pos;
+};
+
+#endif /* BOARD_HAS_CELLULAR */
@@ -0,0 +1,274 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerDNSCache.h"
+
+#if defined(ARDUINO_ARCH_MBED)
+  #include <mbed.h>
+#endif
+
+/******************************************************************************
+  CTOR/DTOR
+ ******************************************************************************/
+
+DNSCache::DNSCache()
+: _known_hosts_count{0}
+, _ttl{CONNECTION_HANDLER_DNS_TTL}
+, _stats{0, 0, 0}
+{
+  for (size_t i = 0; i < CONNECTION_HANDLER_DNS_CACHE_SIZE; i++) {
+    _entries[i].key = 0;
+    _entries[i].adapter = NetworkAdapter::NONE;
+    _preferences[i].key = 0;
+    _preferences[i].adapter = NetworkAdapter::NONE;
+  }
+}
+
+/******************************************************************************
+  PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+
+DNSCache & DNSCache::instance()
+{
+  static DNSCache cache;
+  return cache;
+}
+
+bool DNSCache::lookup(const char * host, NetworkAdapter const adapter, IPAddress & ip, IPFamily const family)
+{
+  ConnectionHandlerLock lock(_mutex);
+  Entry const * entry = findValid(host, adapter, family);
+  if (entry == nullptr) {
+    _stats.misses++;
+    return false;
+  }
+
+  ip = entry->ip;
+  _stats.hits++;
+  return true;
+}
+
+void DNSCache::insert(const char * host, NetworkAdapter const adapter, IPAddress const & ip, IPFamily const family)
+{
+  ConnectionHandlerLock lock(_mutex);
+  if (!fits(host)) {
+    return;
+  }
+
+  unsigned long const now = millis();
+  Entry * entry = find(host, adapter, family);
+
+  if (entry == nullptr) {
+    /* Take a free slot or replace the oldest entry */
+    entry = &_entries[0];
+    for (size_t i = 1; i < CONNECTION_HANDLER_DNS_CACHE_SIZE && entry->key != 0; i++) {
+      if (_entries[i].key == 0 || (now - _entries[i].timestamp) > (now - entry->timestamp)) {
+        entry = &_entries[i];
+      }
+    }
+  }
+
+  entry->key = key(host);
+  strcpy(entry->host, host);
+  entry->adapter = adapter;
+  entry->family = family;
+  entry->timestamp = now;
+  entry->ip = ip;
+}
+
+void DNSCache::flush()
+{
+  ConnectionHandlerLock lock(_mutex);
+  for (size_t i = 0; i < CONNECTION_HANDLER_DNS_CACHE_SIZE; i++) {
+    _entries[i].key = 0;
+    _preferences[i].key = 0;
+  }
+  _stats.flushes++;
+}
+
+void DNSCache::flush(NetworkAdapter const adapter)
+{
+  ConnectionHandlerLock lock(_mutex);
+  /* The address family preferences outlive a connection loss: paying a broken
+   * path again after every link flap is what they avoid.
+   */
+  for (size_t i = 0; i < CONNECTION_HANDLER_DNS_CACHE_SIZE; i++) {
+    if (_entries[i].adapter == adapter) {
+      _entries[i].key = 0;
+    }
+  }
+  _stats.flushes++;
+}
+
+bool DNSCache::getPreferredFamily(const char * host, NetworkAdapter const adapter, IPFamily & family)
+{
+  ConnectionHandlerLock lock(_mutex);
+  Preference * preference = findPreference(host, adapter);
+  if (preference == nullptr) {
+    return false;
+  }
+
+  if ((millis() - preference->timestamp) >= _ttl) {
+    preference->key = 0;
+    return false;
+  }
+
+  family = preference->family;
+  return true;
+}
+
+void DNSCache::setPreferredFamily(const char * host, NetworkAdapter const adapter, IPFamily const family)
+{
+  ConnectionHandlerLock lock(_mutex);
+  if (!fits(host)) {
+    return;
+  }
+
+  unsigned long const now = millis();
+  Preference * preference = findPreference(host, adapter);
+
+  if (preference == nullptr) {
+    /* Take a free slot or replace the oldest preference */
+    preference = &_preferences[0];
+    for (size_t i = 1; i < CONNECTION_HANDLER_DNS_CACHE_SIZE && preference->key != 0; i++) {
+      if (_preferences[i].key == 0 || (now - _preferences[i].timestamp) > (now - preference->timestamp)) {
+        preference = &_preferences[i];
+      }
+    }
+  }
+
+  preference->key = key(host);
+  strcpy(preference->host, host);
+  preference->adapter = adapter;
+  preference->family = family;
+  preference->timestamp = now;
+}
+
+bool DNSCache::addKnownHost(const char * host)
+{
+  ConnectionHandlerLock lock(_mutex);
+  if (_known_hosts_count >= CONNECTION_HANDLER_DNS_KNOWN_HOSTS) {
+    return false;
+  }
+  _known_hosts[_known_hosts_count++] = host;
+  return true;
+}
+
+bool DNSCache::isCached(const char * host, NetworkAdapter const adapter, IPFamily const family)
+{
+  ConnectionHandlerLock lock(_mutex);
+  return findValid(host, adapter, family) != nullptr;
+}
+
+DNSCacheStats DNSCache::getStats()
+{
+  ConnectionHandlerLock lock(_mutex);
+  return _stats;
+}
+
+size_t DNSCache::getKnownHostsCount()
+{
+  ConnectionHandlerLock lock(_mutex);
+  return _known_hosts_count;
+}
+
+const char * DNSCache::getKnownHost(size_t const i)
+{
+  ConnectionHandlerLock lock(_mutex);
+  return _known_hosts[i];
+}
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+uint32_t DNSCache::key(const char * host)
+{
+  /* FNV-1a of the hostname, 0 marks a free slot */
+  uint32_t hash = 2166136261UL;
+  for (; *host != '\0'; host++) {
+    hash = (hash ^ static_cast<uint8_t>(*host)) * 16777619UL;
+  }
+  return hash != 0 ? hash : 1;
+}
+
+bool DNSCache::fits(const char * host)
+{
+  return strlen(host) < CONNECTION_HANDLER_DNS_HOST_SIZE;
+}
+
+DNSCache::Entry * DNSCache::find(const char * host, NetworkAdapter const adapter, IPFamily const family)
+{
+  /* A hash collision must never return the address of another host */
+  uint32_t const k = key(host);
+  for (size_t i = 0; i < CONNECTION_HANDLER_DNS_CACHE_SIZE; i++) {
+    if (_entries[i].key == k && _entries[i].adapter == adapter && _entries[i].family == family &&
+        strcmp(_entries[i].host, host) == 0) {
+      return &_entries[i];
+    }
+  }
+  return nullptr;
+}
+
+DNSCache::Preference * DNSCache::findPreference(const char * host, NetworkAdapter const adapter)
+{
+  uint32_t const k = key(host);
+  for (size_t i = 0; i < CONNECTION_HANDLER_DNS_CACHE_SIZE; i++) {
+    if (_preferences[i].key == k && _preferences[i].adapter == adapter && strcmp(_preferences[i].host, host) == 0) {
+      return &_preferences[i];
+    }
+  }
+  return nullptr;
+}
+
+DNSCache::Entry * DNSCache::findValid(const char * host, NetworkAdapter const adapter, IPFamily const family)
+{
+  Entry * entry = find(host, adapter, family);
+  if (entry == nullptr) {
+    return nullptr;
+  }
+
+  if ((millis() - entry->timestamp) >= _ttl) {
+    entry->key = 0;
+    return nullptr;
+  }
+  return entry;
+}
+
+/******************************************************************************
+  FUNCTION DEFINITION
+ ******************************************************************************/
+
+#if defined(ARDUINO_ARCH_MBED)
+int mbed_host_by_name(NetworkInterface * net, const char * host, IPAddress & ip, IPFamily const family)
+{
+  if (net == nullptr) {
+    return 0;
+  }
+
+  SocketAddress address;
+  nsapi_version_t const version = (family == IPFamily::IPV6) ? NSAPI_IPv6 : NSAPI_IPv4;
+  if (net->gethostbyname(host, &address, version) != NSAPI_ERROR_OK || address.get_ip_version() != version) {
+    return 0;
+  }
+
+  uint8_t const * bytes = static_cast<uint8_t const *>(address.get_ip_bytes());
+  if (family == IPFamily::IPV6) {
+    ip = IPAddress(IPv6, bytes);
+  } else {
+    ip = IPAddress(bytes[0], bytes[1], bytes[2], bytes[3]);
+  }
+  return 1;
+}
+#endif
@@ -0,0 +1,168 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include "ConnectionHandlerDefinitions.h"
+#include "ConnectionHandlerMutex.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#ifndef CONNECTION_HANDLER_DNS_CACHE_SIZE
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_DNS_CACHE_SIZE 2
+  #else
+    #define CONNECTION_HANDLER_DNS_CACHE_SIZE 4
+  #endif
+#endif
+
+#ifndef CONNECTION_HANDLER_DNS_KNOWN_HOSTS
+  #define CONNECTION_HANDLER_DNS_KNOWN_HOSTS 4
+#endif
+
+/* Longest hostname cached, longer ones are always resolved */
+#ifndef CONNECTION_HANDLER_DNS_HOST_SIZE
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_DNS_HOST_SIZE 32
+  #else
+    #define CONNECTION_HANDLER_DNS_HOST_SIZE 64
+  #endif
+#endif
+
+/* Delay before the resolve-ahead step tries again a known host it could not
+ * resolve, doubled after each failure up to the maximum, ms
+ */
+#ifndef CONNECTION_HANDLER_DNS_RETRY_MIN
+  #define CONNECTION_HANDLER_DNS_RETRY_MIN 2000UL
+#endif
+
+#ifndef CONNECTION_HANDLER_DNS_RETRY_MAX
+  #define CONNECTION_HANDLER_DNS_RETRY_MAX 60000UL
+#endif
+
+/* The Arduino network APIs don't report the TTL of the records, this one is used instead */
+#ifndef CONNECTION_HANDLER_DNS_TTL
+  #define CONNECTION_HANDLER_DNS_TTL 300000UL
+#endif
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+/* Address family of a resolved hostname */
+enum class IPFamily : uint8_t {
+  IPV4 = 4,
+  IPV6 = 6
+};
+
+struct DNSCacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t flushes;
+};
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** DNSCache class
+ * A small fixed-size cache of resolved hostnames shared by all the
+ * connection handlers. Entries are bound to the network interface that
+ * resolved them, they expire after the configured TTL and are flushed when
+ * that interface loses its connection, the address family preferences are
+ * kept until they expire. Hostnames
+ * registered with addKnownHost() are resolved ahead by the handlers while
+ * CONNECTING, so that they are already cached once CONNECTED, the ones which
+ * fail are retried with a backoff while CONNECTED.
+ * All the functions can be called from the background threads of the handlers.
+ */
+class DNSCache
+{
+  public:
+
+    static DNSCache & instance();
+
+    bool lookup(const char * host, NetworkAdapter const adapter, IPAddress & ip, IPFamily const family = IPFamily::IPV4);
+    void insert(const char * host, NetworkAdapter const adapter, IPAddress const & ip, IPFamily const family = IPFamily::IPV4);
+    void flush();
+    void flush(NetworkAdapter const adapter);
+
+    /* Address family which last connected to the host, tried first by the dual-stack connect */
+    bool getPreferredFamily(const char * host, NetworkAdapter const adapter, IPFamily & family);
+    void setPreferredFamily(const char * host, NetworkAdapter const adapter, IPFamily const family);
+
+    inline void setTTL(unsigned long const ttl) { _ttl = ttl; }
+    DNSCacheStats getStats();
+
+    /* The string is not copied and has to stay valid, e.g. a string literal */
+    bool addKnownHost(const char * host);
+    size_t getKnownHostsCount();
+    const char * getKnownHost(size_t const i);
+
+    /* Used by the resolve-ahead step, without affecting the statistics */
+    bool isCached(const char * host, NetworkAdapter const adapter, IPFamily const family = IPFamily::IPV4);
+
+  private:
+
+    DNSCache();
+
+    /* The hash only skips most of the hostname comparisons */
+    struct Entry {
+      uint32_t       key;     /* 0 marks a free slot */
+      char           host[CONNECTION_HANDLER_DNS_HOST_SIZE];
+      NetworkAdapter adapter;
+      IPFamily       family;
+      unsigned long  timestamp;
+      IPAddress      ip;
+    };
+
+    struct Preference {
+      uint32_t       key;
+      char           host[CONNECTION_HANDLER_DNS_HOST_SIZE];
+      NetworkAdapter adapter;
+      IPFamily       family;
+      unsigned long  timestamp;
+    };
+
+    static uint32_t key(const char * host);
+    static bool fits(const char * host);
+    Entry * find(const char * host, NetworkAdapter const adapter, IPFamily const family);
+    Preference * findPreference(const char * host, NetworkAdapter const adapter);
+    /* The entry if it has not expired, nullptr otherwise */
+    Entry * findValid(const char * host, NetworkAdapter const adapter, IPFamily const family);
+
+    ConnectionHandlerMutex _mutex;
+
+    Entry _entries[CONNECTION_HANDLER_DNS_CACHE_SIZE];
+    Preference _preferences[CONNECTION_HANDLER_DNS_CACHE_SIZE];
+    const char * _known_hosts[CONNECTION_HANDLER_DNS_KNOWN_HOSTS];
+    size_t _known_hosts_count;
+    unsigned long _ttl;
+    DNSCacheStats _stats;
+};
+
+/******************************************************************************
+  FUNCTION DECLARATION
+ ******************************************************************************/
+
+#if defined(ARDUINO_ARCH_MBED)
+class NetworkInterface;
+
+/* Resolve a hostname for the given address family through the mbed network stack */
+int mbed_host_by_name(NetworkInterface * net, const char * host, IPAddress & ip, IPFamily const family);
+#endif
@@ -0,0 +1,85 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/* Compile-time log level of the library. The diagnostics below the level are
+ * removed together with their format strings, those above it are still
+ * filtered at runtime by Arduino_DebugUtils. This header redefines the DEBUG_*
+ * macros: it is meant to be included by the library sources only, after any
+ * other header, so that sketches keep the Arduino_DebugUtils definitions.
+ */
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#define CONNECTION_HANDLER_LOG_NONE    0
+#define CONNECTION_HANDLER_LOG_ERROR   1
+#define CONNECTION_HANDLER_LOG_WARNING 2
+#define CONNECTION_HANDLER_LOG_INFO    3
+#define CONNECTION_HANDLER_LOG_DEBUG   4
+#define CONNECTION_HANDLER_LOG_VERBOSE 5
+
+#ifndef CONNECTION_HANDLER_LOG_LEVEL
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_LOG_LEVEL CONNECTION_HANDLER_LOG_NONE
+  #else
+    #define CONNECTION_HANDLER_LOG_LEVEL CONNECTION_HANDLER_LOG_VERBOSE
+  #endif
+#endif
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#if CONNECTION_HANDLER_LOG_LEVEL > CONNECTION_HANDLER_LOG_NONE
+  #include <Arduino_DebugUtils.h>
+#endif
+
+/******************************************************************************
+  DEFINES
+ ******************************************************************************/
+
+#undef DEBUG_ERROR
+#undef DEBUG_WARNING
+#undef DEBUG_INFO
+#undef DEBUG_DEBUG
+#undef DEBUG_VERBOSE
+
+#if CONNECTION_HANDLER_LOG_LEVEL >= CONNECTION_HANDLER_LOG_ERROR
+  #define DEBUG_ERROR(fmt, ...) Debug.print(DBG_ERROR, fmt, ## __VA_ARGS__)
+#else
+  #define DEBUG_ERROR(fmt, ...) do { } while (0)
+#endif
+
+#if CONNECTION_HANDLER_LOG_LEVEL >= CONNECTION_HANDLER_LOG_WARNING
+  #define DEBUG_WARNING(fmt, ...) Debug.print(DBG_WARNING, fmt, ## __VA_ARGS__)
+#else
+  #define DEBUG_WARNING(fmt, ...) do { } while (0)
+#endif
+
+#if CONNECTION_HANDLER_LOG_LEVEL >= CONNECTION_HANDLER_LOG_INFO
+  #define DEBUG_INFO(fmt, ...) Debug.print(DBG_INFO, fmt, ## __VA_ARGS__)
+#else
+  #define DEBUG_INFO(fmt, ...) do { } while (0)
+#endif
+
+#if CONNECTION_HANDLER_LOG_LEVEL >= CONNECTION_HANDLER_LOG_DEBUG
+  #define DEBUG_DEBUG(fmt, ...) Debug.print(DBG_DEBUG, fmt, ## __VA_ARGS__)
+#else
+  #define DEBUG_DEBUG(fmt, ...) do { } while (0)
+#endif
+
+#if CONNECTION_HANDLER_LOG_LEVEL >= CONNECTION_HANDLER_LOG_VERBOSE
+  #define DEBUG_VERBOSE(fmt, ...) Debug.print(DBG_VERBOSE, fmt, ## __VA_ARGS__)
+#else
+  #define DEBUG_VERBOSE(fmt, ...) do { } while (0)
+#endif
@@ -152,6 +152,13 @@
   #define NETWORK_CONNECTED WL_CONNECTED
 #endif
 
+/* CONNECTION_HANDLER_STD_THREAD selects the std::thread backend of ConnectionHandlerThread
+ * on the other platforms providing it
+ */
+#if defined(ARDUINO_ARCH_MBED) || defined(ARDUINO_ARCH_ESP32) || defined(CONNECTION_HANDLER_STD_THREAD)
+  #define BOARD_HAS_RTOS
+#endif
+
 #if !defined(BOARD_HAS_WIFI) && \
   !defined(BOARD_HAS_ETHERNET) && \
   !defined(BOARD_HAS_CATM1_NBIOT) && \
@@ -0,0 +1,59 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerEnergy.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+/* Current in mA for INIT, CONNECTING, CONNECTED, DISCONNECTING, DISCONNECTED, CLOSED and ERROR */
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+static EnergyProfile const WIFI_ENERGY_PROFILE     {{ 170, 130, 100, 100,  20,   0,   0 }};
+#elif defined(ARDUINO_UNOR4_WIFI)
+static EnergyProfile const WIFI_ENERGY_PROFILE     {{ 150, 110,  90,  90,  20,   0,   0 }};
+#else /* u-blox NINA-W102 and Murata 1DX */
+static EnergyProfile const WIFI_ENERGY_PROFILE     {{ 120, 100,  80,  80,  20,   0,   0 }};
+#endif
+static EnergyProfile const ETHERNET_ENERGY_PROFILE {{  60,  60,  60,  60,  60,   0,   0 }};
+/* u-blox SARA-U201 */
+static EnergyProfile const GSM_ENERGY_PROFILE      {{ 150, 100,  20,  50,  10,   0,   0 }};
+/* u-blox SARA-R410M */
+static EnergyProfile const NB_ENERGY_PROFILE       {{ 100,  60,  10,  30,   5,   0,   0 }};
+/* Murata CMWX1ZZABZ, the module sleeps between uplinks once joined */
+static EnergyProfile const LORA_ENERGY_PROFILE     {{  10,  40,   2,   2,   1,   0,   0 }};
+/* Quectel BG96 */
+static EnergyProfile const CATM1_ENERGY_PROFILE    {{ 120,  80,  15,  40,   5,   0,   0 }};
+/* Quectel EC200A */
+static EnergyProfile const CELL_ENERGY_PROFILE     {{ 200, 150,  40,  60,  20,   0,   0 }};
+static EnergyProfile const NONE_ENERGY_PROFILE     {{   0,   0,   0,   0,   0,   0,   0 }};
+
+/******************************************************************************
+  FUNCTION DEFINITION
+ ******************************************************************************/
+
+EnergyProfile const & defaultEnergyProfile(NetworkAdapter const adapter)
+{
+  switch (adapter)
+  {
+    case NetworkAdapter::WIFI:     return WIFI_ENERGY_PROFILE;
+    case NetworkAdapter::ETHERNET: return ETHERNET_ENERGY_PROFILE;
+    case NetworkAdapter::NB:       return NB_ENERGY_PROFILE;
+    case NetworkAdapter::GSM:      return GSM_ENERGY_PROFILE;
+    case NetworkAdapter::LORA:     return LORA_ENERGY_PROFILE;
+    case NetworkAdapter::CATM1:    return CATM1_ENERGY_PROFILE;
+    case NetworkAdapter::CELL:     return CELL_ENERGY_PROFILE;
+    default:                       return NONE_ENERGY_PROFILE;
+  }
+}
@@ -0,0 +1,51 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "ConnectionHandlerDefinitions.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#define CONNECTION_HANDLER_STATES_COUNT 7
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+/* Average current drawn by the network interface in each NetworkConnectionState,
+ * in mA, indexed as TimeoutTable. A state drawing no current is a radio-off state.
+ */
+struct EnergyProfile {
+  uint16_t current[CONNECTION_HANDLER_STATES_COUNT];
+};
+
+struct EnergyStats {
+  uint64_t time[CONNECTION_HANDLER_STATES_COUNT]; /* ms spent in each NetworkConnectionState */
+  uint64_t radio_on_time;                         /* ms spent in the states drawing current */
+  float    charge;                                /* estimated charge, mAh */
+};
+
+/******************************************************************************
+  FUNCTION DECLARATION
+ ******************************************************************************/
+
+/* Typical figures of the network module fitted on the board for the given
+ * adapter, taken from the module datasheets. They are rough estimates meant
+ * to compare connection policies, not to replace a measurement.
+ */
+EnergyProfile const & defaultEnergyProfile(NetworkAdapter const adapter);
@@ -13,6 +13,9 @@
  ******************************************************************************/
 
 #include "ConnectionHandlerInterface.h"
+#include "ConnectionHandlerThread.h"
+#include "ConnectionHandlerOutbox.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
   CONSTRUCTOR/DESTRUCTOR
@@ -23,10 +26,24 @@ ConnectionHandler::ConnectionHandler(bool const keep_alive, NetworkAdapter inter
 , _check_internet_availability{false}
 , _interface{interface}
 , _lastConnectionTickTime{millis()}
+, _step{0}
+, _stepStartTime{millis()}
 , _current_net_connection_state{NetworkConnectionState::INIT}
 , _timeoutTable(DefaultTimeoutTable)
+, _energy_last_time{millis()}
 {
-
+  memset(_energy_time, 0, sizeof(_energy_time));
+  memset(&_duty_cycle, 0, sizeof(_duty_cycle));
+  memset(&_check_time, 0, sizeof(_check_time));
+#if !defined(BOARD_HAS_LORA)
+  _cost_weight = defaultCostWeight(interface);
+  _flap_next = 0;
+  _flaps_recorded = 0;
+  _resolve_ahead_pending = false;
+  _resolve_ahead_time = 0;
+  _resolve_ahead_backoff = 0;
+#endif
+  _duty_cycle.stats.time_to_connect = CONNECTION_HANDLER_DUTY_CYCLE_CONNECT_TIME;
 }
 
 /******************************************************************************
@@ -35,7 +52,34 @@ ConnectionHandler::ConnectionHandler(bool const keep_alive, NetworkAdapter inter
 
 NetworkConnectionState ConnectionHandler::check()
 {
+#if defined(BOARD_HAS_RTOS)
+  /* The state machine is run by a ConnectionHandlerThread: deliver the events
+   * recorded meanwhile in the calling thread and return the published state.
+   */
+  if (_thread != nullptr && !_thread->isBackgroundThread()) {
+    _thread->dispatch();
+    NetworkConnectionState const state = _thread->state();
+    /* The state machine stops the pooled sockets on a connection loss: the outbox
+     * is drained only while it doesn't run, never waiting for a blocking driver call.
+     */
+    if (_outbox != nullptr && _thread->tryLock()) {
+      _outbox->drain(*this, _thread->state());
+      _thread->unlock();
+    }
+    return state;
+  }
+#endif
+
   unsigned long const now = millis();
+
+  /* The state can only change in here, the time elapsed since the previous call is spent in the current one */
+  _energy_time[static_cast<unsigned int>(_current_net_connection_state)] += now - _energy_last_time;
+  _energy_last_time = now;
+
+  if (_duty_cycle.period != 0) {
+    updateDutyCycle(now);
+  }
+
   unsigned int const connectionTickTimeInterval =
     _timeoutTable.intervals[static_cast<unsigned int>(_current_net_connection_state)];
 
@@ -44,7 +88,13 @@ NetworkConnectionState ConnectionHandler::check()
     _lastConnectionTickTime = now;
 
     NetworkConnectionState old_net_connection_state = _current_net_connection_state;
+    unsigned long const start = micros();
     NetworkConnectionState next_net_connection_state = updateConnectionState();
+    _check_time.last = micros() - start;
+    if (_check_time.last > _check_time.max) {
+      _check_time.max = _check_time.last;
+      _check_time.max_state = old_net_connection_state;
+    }
 
     /* Here we are determining whether a state transition from one state to the next has
      * occurred - and if it has, we call eventually registered callbacks.
@@ -62,6 +112,15 @@ NetworkConnectionState ConnectionHandler::check()
     }
   }
 
+#if defined(BOARD_HAS_RTOS)
+  /* Drained by the application thread only, see above */
+  if (_outbox != nullptr && _thread == nullptr) {
+#else
+  if (_outbox != nullptr) {
+#endif
+    _outbox->drain(*this, _current_net_connection_state);
+  }
+
   return _current_net_connection_state;
 }
 
@@ -74,14 +133,65 @@ NetworkConnectionState ConnectionHandler::updateConnectionState() {
   switch (_current_net_connection_state)
   {
     case NetworkConnectionState::INIT:          next_net_connection_state = update_handleInit         (); break;
-    case NetworkConnectionState::CONNECTING:    next_net_connection_state = update_handleConnecting   (); break;
-    case NetworkConnectionState::CONNECTED:     next_net_connection_state = update_handleConnected    (); break;
+    case NetworkConnectionState::CONNECTING:    next_net_connection_state = update_handleConnecting   ();
+#if !defined(BOARD_HAS_LORA)
+      if (next_net_connection_state == NetworkConnectionState::CONNECTING ||
+          next_net_connection_state == NetworkConnectionState::CONNECTED) {
+        resolveAhead();
+      }
+#endif
+      break;
+    case NetworkConnectionState::CONNECTED:     next_net_connection_state = update_handleConnected    ();
+#if !defined(BOARD_HAS_LORA)
+      /* CONNECTING can last a single tick: the failed hosts are retried from here */
+      if (next_net_connection_state == NetworkConnectionState::CONNECTED) {
+        resolveAhead();
+      }
+#endif
+      break;
     case NetworkConnectionState::DISCONNECTING: next_net_connection_state = update_handleDisconnecting(); break;
     case NetworkConnectionState::DISCONNECTED:  next_net_connection_state = update_handleDisconnected (); break;
     case NetworkConnectionState::ERROR:                                                                   break;
     case NetworkConnectionState::CLOSED:                                                                  break;
   }
 
+  /* A new state always starts from its first sub-step */
+  if (next_net_connection_state != _current_net_connection_state) {
+    trace(TraceEvent::TRANSITION, static_cast<int32_t>(next_net_connection_state));
+    resetStep();
+
+#if !defined(BOARD_HAS_LORA)
+    /* The known hosts are resolved once per bring-up */
+    if (next_net_connection_state == NetworkConnectionState::CONNECTING) {
+      _resolve_ahead_pending = true;
+      _resolve_ahead_backoff = 0;
+    }
+
+    /* A connection loss, a disconnect() goes through DISCONNECTING */
+    if (_current_net_connection_state == NetworkConnectionState::CONNECTED &&
+        next_net_connection_state == NetworkConnectionState::DISCONNECTED) {
+      _flap_times[_flap_next] = millis();
+      _flap_next = (_flap_next + 1) % CONNECTION_HANDLER_QUALITY_FLAPS;
+      if (_flaps_recorded < CONNECTION_HANDLER_QUALITY_FLAPS) _flaps_recorded++;
+    }
+
+    /* Connections opened by pooled sockets don't survive a connection loss */
+    if (next_net_connection_state == NetworkConnectionState::DISCONNECTED) {
+      ConnectionHandlerLock lock(_pool_mutex);
+      if (_client_pool != nullptr) _client_pool->invalidate();
+      if (_udp_pool != nullptr)    _udp_pool->invalidate();
+      DNSCache::instance().flush(_interface);
+    }
+#endif
+
+    /* The interface is down: the next bring-up uses the staged settings */
+    if (next_net_connection_state == NetworkConnectionState::DISCONNECTED && _pending_setting) {
+      memcpy(&_settings, &_pending_settings, sizeof(_settings));
+      _pending_setting = false;
+      DEBUG_INFO(F("Staged settings applied"));
+    }
+  }
+
   /* Assign new state to the member variable holding the state */
   _current_net_connection_state = next_net_connection_state;
 
@@ -90,6 +200,14 @@ NetworkConnectionState ConnectionHandler::updateConnectionState() {
 
 void ConnectionHandler::updateCallback(NetworkConnectionState next_net_connection_state) {
 
+#if defined(BOARD_HAS_RTOS)
+  /* Callbacks are marshalled to the thread calling check() or to the event queue */
+  if (_thread != nullptr) {
+    _thread->post(next_net_connection_state);
+    return;
+  }
+#endif
+
   /* Check the next state to determine the kind of state conversion which has occurred (and call the appropriate callback) */
   if(next_net_connection_state == NetworkConnectionState::CONNECTED)
   {
@@ -105,19 +223,180 @@ void ConnectionHandler::updateCallback(NetworkConnectionState next_net_connectio
   }
 }
 
+#if !defined(BOARD_HAS_LORA)
+void ConnectionHandler::resolveAhead()
+{
+  /* Warm the cache with the endpoints the application is going to connect to.
+   * hostByName() blocks, seconds of AT commands on cellular: the hosts are
+   * resolved once when CONNECTING is entered, the ones which fail are tried
+   * again later, also once CONNECTED, with an increasing delay rather than on
+   * every check().
+   */
+  if (!_resolve_ahead_pending) {
+    return;
+  }
+
+  unsigned long const now = millis();
+  if (_resolve_ahead_backoff != 0 && (now - _resolve_ahead_time) < _resolve_ahead_backoff) {
+    return;
+  }
+
+  DNSCache & cache = DNSCache::instance();
+
+  for (size_t i = 0; i < cache.getKnownHostsCount(); i++) {
+    const char * host = cache.getKnownHost(i);
+    IPAddress ip;
+
+    if (cache.isCached(host, _interface)) {
+      continue;
+    }
+    if (hostByName(host, ip, IPFamily::IPV4) != 1) {
+      _resolve_ahead_time = millis();
+      _resolve_ahead_backoff = _resolve_ahead_backoff == 0 ? CONNECTION_HANDLER_DNS_RETRY_MIN :
+                               (_resolve_ahead_backoff * 2 < CONNECTION_HANDLER_DNS_RETRY_MAX ? _resolve_ahead_backoff * 2 : CONNECTION_HANDLER_DNS_RETRY_MAX);
+      return;
+    }
+    cache.insert(host, _interface, ip);
+  }
+
+  _resolve_ahead_pending = false;
+}
+
+int ConnectionHandler::tcpRTT(const char * host, IPAddress const & ip, uint16_t const port)
+{
+  Client * client = acquireClient();
+  bool const pooled = client != nullptr;
+
+  if (!pooled) {
+    /* The main client is borrowed only while the application is not using it */
+    client = &getClient();
+    if (client->connected()) {
+      return -1;
+    }
+  }
+
+  unsigned long const start = millis();
+  int const connected = host != nullptr ? client->connect(host, port) : client->connect(ip, port);
+  unsigned long const rtt = millis() - start;
+  client->stop();
+
+  if (pooled) {
+    releaseClient(client);
+  }
+  return connected == 1 ? static_cast<int>(rtt) : -1;
+}
+#endif
+
+bool ConnectionHandler::updateSetting(const models::NetworkSetting& s)
+{
+  if (s.type != _interface) {
+    return false;
+  }
+
+  /* The settings are read while bringing the interface up and kept as long as it is up */
+  bool const in_use = _current_net_connection_state == NetworkConnectionState::CONNECTING ||
+                      _current_net_connection_state == NetworkConnectionState::CONNECTED  ||
+                      _current_net_connection_state == NetworkConnectionState::DISCONNECTING;
+
+  if (!in_use || !requiresReconnect(s)) {
+    memcpy(&_settings, &s, sizeof(s));
+    _pending_setting = false;
+    return true;
+  }
+
+  memcpy(&_pending_settings, &s, sizeof(s));
+  _pending_setting = true;
+  DEBUG_INFO(F("Settings staged until the next reconnection"));
+  return true;
+}
+
+void ConnectionHandler::applySettings()
+{
+  if (!_pending_setting) {
+    return;
+  }
+
+  if (_current_net_connection_state == NetworkConnectionState::CONNECTING ||
+      _current_net_connection_state == NetworkConnectionState::CONNECTED) {
+    /* Same as disconnect() but keeping _keep_alive, the handler goes back to INIT */
+    trace(TraceEvent::DISCONNECT);
+    _current_net_connection_state = NetworkConnectionState::DISCONNECTING;
+    resetStep();
+  } else if (_current_net_connection_state != NetworkConnectionState::DISCONNECTING) {
+    memcpy(&_settings, &_pending_settings, sizeof(_settings));
+    _pending_setting = false;
+  }
+}
+
 void ConnectionHandler::connect()
 {
   if (_current_net_connection_state != NetworkConnectionState::INIT && _current_net_connection_state != NetworkConnectionState::CONNECTING)
   {
+    trace(TraceEvent::CONNECT);
     _keep_alive = true;
     _current_net_connection_state = NetworkConnectionState::INIT;
+    resetStep();
   }
 }
 
 void ConnectionHandler::disconnect()
 {
+  trace(TraceEvent::DISCONNECT);
   _keep_alive = false;
   _current_net_connection_state = NetworkConnectionState::DISCONNECTING;
+  resetStep();
+}
+
+void ConnectionHandler::enableDutyCycle(unsigned long const period)
+{
+  if (_duty_cycle.period == 0) {
+    _duty_cycle.keep_alive = _keep_alive;
+  }
+  _duty_cycle.window = millis();
+  _duty_cycle.wake = _duty_cycle.window;
+  _duty_cycle.radio_on = true;
+  _duty_cycle.connecting = true;
+  _duty_cycle.done = false;
+  _duty_cycle.period = period;
+  connect();
+}
+
+void ConnectionHandler::disableDutyCycle()
+{
+  if (_duty_cycle.period == 0) {
+    return;
+  }
+  _duty_cycle.period = 0;
+  _keep_alive = _duty_cycle.keep_alive;
+
+  /* Between two windows the interface is closed, bring it back if it was kept alive */
+  if (_keep_alive && _current_net_connection_state == NetworkConnectionState::CLOSED) {
+    connect();
+  }
+}
+
+EnergyStats ConnectionHandler::getEnergyStats()
+{
+  EnergyProfile const & profile = _energy_profile != nullptr ? *_energy_profile : defaultEnergyProfile(_interface);
+  EnergyStats stats;
+  float charge = 0.0f; /* mA * ms */
+
+  memset(&stats, 0, sizeof(stats));
+  for (unsigned int i = 0; i < CONNECTION_HANDLER_STATES_COUNT; i++) {
+    stats.time[i] = _energy_time[i];
+    if (profile.current[i] != 0) {
+      stats.radio_on_time += _energy_time[i];
+      charge += static_cast<float>(_energy_time[i]) * profile.current[i];
+    }
+  }
+  stats.charge = charge / 3600000.0f;
+  return stats;
+}
+
+void ConnectionHandler::resetEnergyStats()
+{
+  memset(_energy_time, 0, sizeof(_energy_time));
+  _energy_last_time = millis();
 }
 
 void ConnectionHandler::addCallback(NetworkConnectionEvent const event, OnNetworkEventCallback callback)
@@ -130,6 +409,172 @@ void ConnectionHandler::addCallback(NetworkConnectionEvent const event, OnNetwor
   }
 }
 
+#if !defined(BOARD_HAS_LORA)
+int ConnectionHandler::resolve(const char * host, IPAddress & ip, IPFamily const family)
+{
+  DNSCache & cache = DNSCache::instance();
+
+  if (cache.lookup(host, _interface, ip, family)) {
+    return 1;
+  }
+
+  if (hostByName(host, ip, family) != 1) {
+    return 0;
+  }
+
+  cache.insert(host, _interface, ip, family);
+  return 1;
+}
+
+int ConnectionHandler::connectClient(Client & client, const char * host, uint16_t const port)
+{
+  DNSCache & cache = DNSCache::instance();
+  IPFamily families[2] = { IPFamily::IPV4, IPFamily::IPV6 };
+  IPFamily preferred;
+
+  /* IPv4 works almost everywhere: IPv6 goes first only once it has connected */
+  if (cache.getPreferredFamily(host, _interface, preferred) && preferred == IPFamily::IPV6) {
+    families[0] = IPFamily::IPV6;
+    families[1] = IPFamily::IPV4;
+  }
+
+  IPAddress ips[2];
+  bool resolved[2];
+  for (size_t i = 0; i < 2; i++) {
+    resolved[i] = resolve(host, ips[i], families[i]) == 1;
+  }
+
+  /* No resolver on this interface, e.g. cellular: the client resolves the host */
+  if (!resolved[0] && !resolved[1]) {
+    return client.connect(host, port) == 1 ? 1 : 0;
+  }
+
+  /* Client::connect() is blocking, so the attempts are sequential. The first one
+   * is bounded where the client allows it only if the other family resolved,
+   * and the working family is remembered for the host, also across reconnections.
+   */
+  for (size_t i = 0; i < 2; i++) {
+    if (!resolved[i]) {
+      continue;
+    }
+
+    bool const fallback = i == 0 && resolved[1];
+    if (connectTimeout(client, ips[i], port, fallback ? CONNECTION_HANDLER_CONNECT_FALLBACK_TIMEOUT : CONNECTION_HANDLER_CONNECT_TIMEOUT)) {
+      cache.setPreferredFamily(host, _interface, families[i]);
+      return 1;
+    }
+    client.stop();
+    DEBUG_DEBUG(F("IPv%d connection to %s failed"), static_cast<int>(families[i]), host);
+  }
+
+  return 0;
+}
+
+RTTStats ConnectionHandler::measureRTT(const char * host, uint8_t const count, uint16_t const port)
+{
+  RTTStats stats = {0, 0, 0, 0, 0, RTTMethod::NONE};
+  unsigned long total = 0;
+  IPAddress ip;
+
+  /* Without a resolver only the TCP connection to the host name can be timed */
+  bool const resolved = resolve(host, ip) == 1;
+  if (!resolved) {
+    DEBUG_DEBUG(F("RTT measurement: %s not resolved, connecting by name"), host);
+    stats.method = RTTMethod::TCP;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    int rtt = -1;
+
+    /* ICMP is often filtered, e.g. by cellular operators: TCP is used from the
+     * first probe on if it doesn't get an answer.
+     */
+    if (stats.method != RTTMethod::TCP) {
+      rtt = icmpRTT(ip);
+      if (i == 0) {
+        stats.method = rtt >= 0 ? RTTMethod::ICMP : RTTMethod::TCP;
+      }
+    }
+    if (stats.method == RTTMethod::TCP) {
+      rtt = tcpRTT(resolved ? nullptr : host, ip, port);
+    }
+
+    stats.sent++;
+    if (rtt < 0) {
+      continue;
+    }
+
+    unsigned long const value = static_cast<unsigned long>(rtt);
+    if (stats.received == 0 || value < stats.min) stats.min = value;
+    if (value > stats.max) stats.max = value;
+    total += value;
+    stats.received++;
+  }
+
+  if (stats.received > 0) {
+    stats.avg = total / stats.received;
+  }
+  trace(TraceEvent::PING, stats.received > 0 ? static_cast<int32_t>(stats.avg) : -1);
+  DEBUG_DEBUG(F("RTT to %s: %d/%d received, min %lu avg %lu max %lu ms"), host, stats.received, stats.sent, stats.min, stats.avg, stats.max);
+
+  _rtt_stats = stats;
+  return stats;
+}
+
+ConnectionQuality ConnectionHandler::getQuality()
+{
+  unsigned long const now = millis();
+  uint8_t flaps = 0;
+
+  for (uint8_t i = 0; i < _flaps_recorded; i++) {
+    if (now - _flap_times[i] < CONNECTION_HANDLER_QUALITY_FLAP_WINDOW) {
+      flaps++;
+    }
+  }
+
+  ConnectionQuality quality = computeQuality(_rtt_stats.avg, _rtt_stats.sent, _rtt_stats.received,
+                                             linkQuality(), flaps, _cost_weight);
+  if (_current_net_connection_state != NetworkConnectionState::CONNECTED) {
+    quality.score = 0;
+  }
+  return quality;
+}
+
+Client * ConnectionHandler::acquireClient()
+{
+  ConnectionHandlerLock lock(_pool_mutex);
+  return _client_pool != nullptr ? _client_pool->acquire() : nullptr;
+}
+
+bool ConnectionHandler::releaseClient(Client * client)
+{
+  ConnectionHandlerLock lock(_pool_mutex);
+  return _client_pool != nullptr ? _client_pool->release(client) : false;
+}
+
+UDP * ConnectionHandler::acquireUDP()
+{
+  ConnectionHandlerLock lock(_pool_mutex);
+  return _udp_pool != nullptr ? _udp_pool->acquire() : nullptr;
+}
+
+bool ConnectionHandler::releaseUDP(UDP * udp)
+{
+  ConnectionHandlerLock lock(_pool_mutex);
+  return _udp_pool != nullptr ? _udp_pool->release(udp) : false;
+}
+
+SocketPoolStats ConnectionHandler::getClientPoolStats()
+{
+  return _client_pool != nullptr ? _client_pool->stats() : SocketPoolStats{0, 0, 0, 0, 0, 0};
+}
+
+SocketPoolStats ConnectionHandler::getUDPPoolStats()
+{
+  return _udp_pool != nullptr ? _udp_pool->stats() : SocketPoolStats{0, 0, 0, 0, 0, 0};
+}
+#endif
+
 void ConnectionHandler::addConnectCallback(OnNetworkEventCallback callback) {
   _on_connect_event_callback = callback;
 }
@@ -139,3 +584,76 @@ void ConnectionHandler::addDisconnectCallback(OnNetworkEventCallback callback) {
 void ConnectionHandler::addErrorCallback(OnNetworkEventCallback callback) {
   _on_error_event_callback = callback;
 }
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+void ConnectionHandler::updateDutyCycle(unsigned long const now)
+{
+  NetworkConnectionState const state = _current_net_connection_state;
+
+  if (!_duty_cycle.radio_on) {
+    /* Leave some margin over the learned bring-up time */
+    unsigned long const lead = _duty_cycle.stats.time_to_connect + _duty_cycle.stats.time_to_connect / 4;
+
+    if (static_cast<long>(now - (_duty_cycle.window - lead)) >= 0) {
+      _duty_cycle.radio_on = true;
+      _duty_cycle.connecting = true;
+      _duty_cycle.wake = now;
+      connect();
+    }
+    return;
+  }
+
+  if (_duty_cycle.connecting && state == NetworkConnectionState::CONNECTED) {
+    unsigned long const measured = now - _duty_cycle.wake;
+
+    _duty_cycle.connecting = false;
+    if (_duty_cycle.learned) {
+      _duty_cycle.stats.time_to_connect = (3 * _duty_cycle.stats.time_to_connect + measured) / 4;
+    } else {
+      _duty_cycle.stats.time_to_connect = measured;
+      _duty_cycle.learned = true;
+    }
+    if (static_cast<long>(now - _duty_cycle.window) > 0) {
+      _duty_cycle.stats.late++;
+    }
+  }
+
+  /* Give up the window if the bring-up fails or takes too long, otherwise the
+   * interface would stay on until it reaches CONNECTED
+   */
+  bool const late = _duty_cycle.connecting &&
+    (now - _duty_cycle.wake) >= CONNECTION_HANDLER_DUTY_CYCLE_CONNECT_TIMEOUT;
+  if (state == NetworkConnectionState::ERROR || late) {
+    if (_duty_cycle.connecting) {
+      _duty_cycle.stats.missed++;
+      DEBUG_WARNING(F("Duty-cycle window missed, %s"), late ? "bring-up timed out" : "interface error");
+    }
+    _duty_cycle.done = true;
+  }
+
+  if (_duty_cycle.done) {
+    _duty_cycle.done = false;
+    _duty_cycle.connecting = false;
+
+    /* Skip the windows the application has overrun */
+    do {
+      _duty_cycle.window += _duty_cycle.period;
+    } while (static_cast<long>(_duty_cycle.window - now) <= 0);
+
+    disconnect();
+    return;
+  }
+
+  if (state == NetworkConnectionState::CLOSED) {
+    _duty_cycle.radio_on = false;
+    _duty_cycle.stats.windows++;
+    _duty_cycle.stats.last_radio_on_time = now - _duty_cycle.wake;
+    _duty_cycle.stats.radio_on_time += _duty_cycle.stats.last_radio_on_time;
+
+    DEBUG_INFO(F("Duty-cycle window closed, radio on for %lu ms, next window in %lu ms"),
+      _duty_cycle.stats.last_radio_on_time, _duty_cycle.window - now);
+  }
+}
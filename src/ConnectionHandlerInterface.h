@@ -22,6 +22,13 @@
 #include <Client.h>
 #include <Udp.h>
 #include "ConnectionHandlerDefinitions.h"
+#include "ConnectionHandlerSocketPool.h"
+#include "ConnectionHandlerMutex.h"
+#include "ConnectionHandlerSessionCache.h"
+#include "ConnectionHandlerDNSCache.h"
+#include "ConnectionHandlerEnergy.h"
+#include "ConnectionHandlerQuality.h"
+#include "ConnectionHandlerTrace.h"
 #include "connectionHandlerModels/settings.h"
 
 #include <utility>
@@ -32,12 +39,72 @@
 
 typedef void (*OnNetworkEventCallback)();
 
+struct DutyCycleStats {
+  uint32_t windows;
+  uint32_t late;                    /* windows reached CONNECTED after their start */
+  uint32_t missed;                  /* windows given up before reaching CONNECTED */
+  unsigned long time_to_connect;    /* learned bring-up time, ms */
+  unsigned long last_radio_on_time; /* radio-on time of the last window, ms */
+  unsigned long radio_on_time;      /* radio-on time of all the windows, ms */
+};
+
+struct CheckTimeStats {
+  unsigned long last;               /* duration of the last state machine run, us */
+  unsigned long max;                /* longest state machine run, us */
+  NetworkConnectionState max_state; /* state the longest run started from */
+};
+
+#if !defined(BOARD_HAS_LORA)
+enum class RTTMethod {
+  NONE,   /* no probe sent */
+  ICMP,   /* echo request */
+  TCP     /* connection handshake */
+};
+
+struct RTTStats {
+  uint8_t sent;
+  uint8_t received;
+  unsigned long min;  /* ms, of the probes received */
+  unsigned long avg;
+  unsigned long max;
+  RTTMethod method;
+};
+#endif
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+/* Bring-up time assumed for the first duty-cycle window, before it is learned */
+#ifndef CONNECTION_HANDLER_DUTY_CYCLE_CONNECT_TIME
+  #define CONNECTION_HANDLER_DUTY_CYCLE_CONNECT_TIME 10000UL
+#endif
+
+/* A duty-cycle window not CONNECTED this long after the bring-up started is given up, ms */
+#ifndef CONNECTION_HANDLER_DUTY_CYCLE_CONNECT_TIMEOUT
+  #define CONNECTION_HANDLER_DUTY_CYCLE_CONNECT_TIMEOUT 60000UL
+#endif
+
+/* Bound of a dual-stack connect attempt followed by one with the other family,
+ * where the client allows it, ms
+ */
+#ifndef CONNECTION_HANDLER_CONNECT_FALLBACK_TIMEOUT
+  #define CONNECTION_HANDLER_CONNECT_FALLBACK_TIMEOUT 3000UL
+#endif
+
+/* Bound of the last connect attempt, where the client allows it, ms */
+#ifndef CONNECTION_HANDLER_CONNECT_TIMEOUT
+  #define CONNECTION_HANDLER_CONNECT_TIMEOUT 15000UL
+#endif
+
 /******************************************************************************
   CLASS DECLARATION
  ******************************************************************************/
 
 // forward declaration FIXME
 class GenericConnectionHandler;
+class ConnectionHandlerThread;
+class Outbox;
 
 class ConnectionHandler {
   public:
@@ -61,6 +128,60 @@ class ConnectionHandler {
       virtual int ping(IPAddress ip, uint8_t ttl = 128, uint8_t count = 1) = 0;
       virtual int ping(const String &hostname, uint8_t ttl = 128, uint8_t count = 1) = 0;
       virtual int ping(const char* host, uint8_t ttl = 128, uint8_t count = 1) = 0;
+
+      /* Resolve a hostname through the DNS cache shared by all the handlers,
+       * returns 1 on success, 0 if it cannot be resolved by this interface.
+       */
+      virtual int resolve(const char * host, IPAddress & ip, IPFamily const family = IPFamily::IPV4);
+
+      /* Dual-stack connect: the address family which last connected to the host
+       * is tried first, IPv4 otherwise, falling back to the other family. When
+       * both resolve, the first attempt is bounded by
+       * CONNECTION_HANDLER_CONNECT_FALLBACK_TIMEOUT where the client belongs to
+       * the handler and its library has a connection timeout. Without a resolver
+       * the client connects by name. Returns 1 when connected, 0 otherwise.
+       */
+      virtual int connectClient(Client & client, const char * host, uint16_t const port);
+
+      /* Round trip time to host over count probes, sent one after the other. ICMP
+       * echo is used where the handler supports it and the first probe gets an
+       * answer, otherwise a TCP connection to port is timed, with a pooled client
+       * or with getClient() if the pool is exhausted and it is not connected.
+       * Where the handler can't resolve host, e.g. on cellular, the client connects
+       * to it by name and the first probe includes the resolution by the modem.
+       */
+      virtual RTTStats measureRTT(const char * host, uint8_t const count = 4, uint16_t const port = 443);
+      inline RTTStats getRTTStats() const { return _rtt_stats; }
+
+      /* Quality of the connection from the last RTT measurement, the link status
+       * and the recent connection losses, weighted by the cost of the interface.
+       * Scores of different interfaces can be compared to rank them.
+       */
+      virtual ConnectionQuality getQuality();
+      inline void setCostWeight(uint8_t const cost) { _cost_weight = cost; }
+      inline uint8_t getCostWeight() const { return _cost_weight; }
+
+      /* Additional sockets taken from the handler pool, independent from the ones
+       * returned by getClient()/getUDP(), so that several libraries can keep their
+       * connections open at the same time. They have to be released when not needed
+       * anymore and are stopped when the connection is lost. nullptr is returned
+       * when the pool is exhausted or not supported by the handler. They can be
+       * acquired and released from any thread.
+       */
+      virtual Client * acquireClient();
+      virtual bool releaseClient(Client * client);
+      virtual UDP * acquireUDP();
+      virtual bool releaseUDP(UDP * udp);
+
+      virtual SocketPoolStats getClientPoolStats();
+      virtual SocketPoolStats getUDPPoolStats();
+
+      /* TLS sessions negotiated by the secure client layer over getClient(). The cache
+       * outlives reconnections so that the next handshake to the same endpoint can be
+       * an abbreviated one, TLS sessions don't depend on the network interface.
+       */
+      inline void setTLSSessionCache(TLSSessionCache * cache) { _tls_session_cache = cache; }
+      inline TLSSessionCache * getTLSSessionCache() { return _tls_session_cache; }
     #endif
 
     NetworkConnectionState getStatus() __attribute__((deprecated)) {
@@ -71,6 +192,11 @@ class ConnectionHandler {
       return _interface;
     }
 
+    /* Interface the sockets are currently taken from, it changes on a MultiConnectionHandler */
+    virtual NetworkAdapter getRoutedAdapter() {
+      return _interface;
+    }
+
     virtual void connect();
     virtual void disconnect();
     void enableCheckInternetAvailability(bool enable) {
@@ -83,20 +209,18 @@ class ConnectionHandler {
     void addErrorCallback(OnNetworkEventCallback callback) __attribute__((deprecated));
 
     /**
-     * Update the interface settings. This can be performed only when the interface is
-     * in INIT state. otherwise nothing is performed. The type of the interface should match
-     * the type of the settings provided
+     * Update the interface settings. The type of the interface should match the type of
+     * the settings provided. While the interface is not in use the settings are applied
+     * immediately, as are changes which don't need a reconnection. Otherwise they are
+     * staged and applied when the interface disconnects, or on applySettings()
      *
-     * @return true if the update is successful, false otherwise
+     * @return true if the update is accepted, false otherwise
      */
-    virtual bool updateSetting(const models::NetworkSetting& s) {
-      if(_current_net_connection_state == NetworkConnectionState::INIT && s.type == _interface) {
-        memcpy(&_settings, &s, sizeof(s));
-        return true;
-      }
+    virtual bool updateSetting(const models::NetworkSetting& s);
 
-      return false;
-    }
+    /* Maintenance point: reconnect now with the staged settings, if any */
+    virtual void applySettings();
+    virtual bool hasPendingSetting() { return _pending_setting; }
 
     virtual void getSetting(models::NetworkSetting& s) {
       memcpy(&s, &_settings, sizeof(s));
@@ -110,11 +234,53 @@ class ConnectionHandler {
     inline void updateTimeoutInterval(NetworkConnectionState state, uint32_t interval) {
       _timeoutTable.intervals[static_cast<unsigned int>(state)] = interval;
     }
+
+    /* Duty-cycle mode: the interface is kept CLOSED between transmission windows
+     * opening every period ms, the first one opens immediately. Bring-up starts
+     * ahead of each window by the learned time-to-connect so that the handler is
+     * CONNECTED at the window start. The application calls dutyCycleDone() once
+     * it has finished with the window and the interface is disconnected again.
+     * A window is also closed when the handler falls in ERROR or doesn't reach
+     * CONNECTED within CONNECTION_HANDLER_DUTY_CYCLE_CONNECT_TIMEOUT, the next one
+     * tries again. disableDutyCycle() restores the keep-alive setting in use before.
+     */
+    void enableDutyCycle(unsigned long const period);
+    void disableDutyCycle();
+    inline void dutyCycleDone() { _duty_cycle.done = true; }
+    inline DutyCycleStats getDutyCycleStats() const { return _duty_cycle.stats; }
+
+    /* Time spent in each state and charge drawn by the interface, estimated with the
+     * default EnergyProfile of the adapter unless a different one is provided.
+     */
+    inline void setEnergyProfile(EnergyProfile const * profile) { _energy_profile = profile; }
+    virtual EnergyStats getEnergyStats();
+    virtual void resetEnergyStats();
+
+    /* Time spent in the state machine by check(), to spot driver calls which block
+     * the application loop. Throttled calls which don't run it are not counted.
+     */
+    inline CheckTimeStats getCheckTimeStats() const { return _check_time; }
+    inline void resetCheckTimeStats() { memset(&_check_time, 0, sizeof(_check_time)); }
+
+    /* Records pushed to the Outbox are sent by check() while CONNECTED, in the
+     * thread calling it, the Outbox has to outlive the handler.
+     */
+    inline void setOutbox(Outbox * outbox) { _outbox = outbox; }
+    inline Outbox * getOutbox() const { return _outbox; }
+
   protected:
 
     virtual NetworkConnectionState updateConnectionState();
     virtual void updateCallback(NetworkConnectionState next_net_connection_state);
 
+    /* Whether moving from the active settings to s requires a reconnection, by
+     * default any change does. Handlers override it to let fields which are read
+     * only on demand, e.g. timeouts, be updated while connected.
+     */
+    virtual bool requiresReconnect(const models::NetworkSetting& s) {
+      return memcmp(&_settings, &s, sizeof(s)) != 0;
+    }
+
     bool _keep_alive;
     bool _check_internet_availability;
     NetworkAdapter _interface;
@@ -125,16 +291,106 @@ class ConnectionHandler {
     virtual NetworkConnectionState update_handleDisconnecting() = 0;
     virtual NetworkConnectionState update_handleDisconnected () = 0;
 
+    /* Resumable sub-steps for the update_handle* functions: a long operation is
+     * started in one step, the handler returns its current state and polls for
+     * completion in the next step on later check() calls. The step counter is
+     * rewound on every state transition.
+     */
+    inline uint8_t step() const { return _step; }
+    inline void nextStep() { _step++; _stepStartTime = millis(); }
+    inline void resetStep() { _step = 0; _stepStartTime = millis(); }
+    inline unsigned long stepElapsed() const { return millis() - _stepStartTime; }
+
+    /* Record a driver event in the shared TraceLog, tagged with adapter and state */
+    inline void trace(TraceEvent const event, int32_t const arg = 0) {
+      TraceLog::instance().record(_interface, _current_net_connection_state, event, arg);
+    }
+
+#if !defined(BOARD_HAS_LORA)
+    /* Resolve a hostname with the DNS of the interface, bypassing the cache.
+     * Returns 1 on success, 0 on failure or if not supported by the handler.
+     */
+    virtual int hostByName(const char * host, IPAddress & ip, IPFamily const family) { (void)host; (void)ip; (void)family; return 0; }
+    void resolveAhead();
+
+    /* One RTT probe, returns the round trip time in ms or a negative value if it
+     * is lost. ICMP is not supported unless the handler overrides icmpRTT().
+     */
+    virtual int icmpRTT(IPAddress const & ip) { (void)ip; return -1; }
+
+    /* Connect to ip within timeout ms. Without an override, or for a client the
+     * handler doesn't own, the timeout of the client library applies.
+     */
+    virtual int connectTimeout(Client & client, IPAddress const & ip, uint16_t const port, unsigned long const timeout) { (void)timeout; return client.connect(ip, port); }
+    /* Time a TCP connection to ip, or to host by name when it is not nullptr */
+    int tcpRTT(const char * host, IPAddress const & ip, uint16_t const port);
+
+    /* Signal strength or link status from 0 to 100, negative if not available */
+    virtual int linkQuality() { return -1; }
+#endif
+
     models::NetworkSetting _settings;
+    models::NetworkSetting _pending_settings;
+    bool _pending_setting = false;
 
     TimeoutTable _timeoutTable;
+
+#if !defined(BOARD_HAS_LORA)
+    SocketPoolInterface<Client> * _client_pool = nullptr;
+    SocketPoolInterface<UDP> * _udp_pool = nullptr;
+    ConnectionHandlerMutex _pool_mutex;  /* the pools are also invalidated by the background thread */
+    TLSSessionCache * _tls_session_cache = nullptr;
+    RTTStats _rtt_stats = {0, 0, 0, 0, 0, RTTMethod::NONE};
+    uint8_t _cost_weight;
+#endif
   private:
 
+    void updateDutyCycle(unsigned long const now);
+
+    struct DutyCycle {
+      unsigned long period;
+      unsigned long window;  /* start of the next or current window */
+      unsigned long wake;    /* start of the bring-up */
+      bool radio_on;
+      bool connecting;
+      bool learned;
+      bool keep_alive;       /* setting to restore when disabled */
+      volatile bool done;
+      DutyCycleStats stats;
+    };
+
     unsigned long _lastConnectionTickTime;
+    uint8_t _step;
+    unsigned long _stepStartTime;
     NetworkConnectionState _current_net_connection_state;
     OnNetworkEventCallback  _on_connect_event_callback = NULL,
                             _on_disconnect_event_callback = NULL,
                             _on_error_event_callback = NULL;
 
+#if defined(BOARD_HAS_RTOS)
+    ConnectionHandlerThread * _thread = nullptr;
+#endif
+
+    DutyCycle _duty_cycle;
+    CheckTimeStats _check_time;
+
+#if !defined(BOARD_HAS_LORA)
+    /* Times of the last connection losses, a ring of CONNECTION_HANDLER_QUALITY_FLAPS */
+    unsigned long _flap_times[CONNECTION_HANDLER_QUALITY_FLAPS];
+    uint8_t _flap_next;
+    uint8_t _flaps_recorded;
+
+    /* Resolve-ahead step of the current CONNECTING phase */
+    bool _resolve_ahead_pending;
+    unsigned long _resolve_ahead_time;
+    unsigned long _resolve_ahead_backoff;
+#endif
+
+    uint64_t _energy_time[CONNECTION_HANDLER_STATES_COUNT];
+    unsigned long _energy_last_time;
+    EnergyProfile const * _energy_profile = nullptr;
+    Outbox * _outbox = nullptr;
+
     friend GenericConnectionHandler;
+    friend ConnectionHandlerThread;
 };
@@ -0,0 +1,79 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include "ConnectionHandlerDefinitions.h"
+
+#if defined(BOARD_HAS_RTOS)
+  #if defined(ARDUINO_ARCH_MBED)
+    #include <mbed.h>
+  #elif defined(ARDUINO_ARCH_ESP32)
+    #include <freertos/FreeRTOS.h>
+    #include <freertos/semphr.h>
+  #else
+    #include <mutex>
+  #endif
+#endif
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** ConnectionHandlerMutex class
+ * Guards the state shared by all the connection handlers, e.g. the DNS cache,
+ * which their background threads and the application thread use at the same
+ * time. It is not recursive and does nothing on the boards without threads.
+ */
+class ConnectionHandlerMutex
+{
+  public:
+
+#if defined(BOARD_HAS_RTOS) && defined(ARDUINO_ARCH_ESP32)
+    ConnectionHandlerMutex() : _mutex{xSemaphoreCreateMutex()} { }
+    inline void lock()   { xSemaphoreTake(_mutex, portMAX_DELAY); }
+    inline void unlock() { xSemaphoreGive(_mutex); }
+#elif defined(BOARD_HAS_RTOS)
+    inline void lock()   { _mutex.lock(); }
+    inline void unlock() { _mutex.unlock(); }
+#else
+    inline void lock()   { }
+    inline void unlock() { }
+#endif
+
+  private:
+
+#if defined(BOARD_HAS_RTOS)
+  #if defined(ARDUINO_ARCH_MBED)
+    rtos::Mutex _mutex;
+  #elif defined(ARDUINO_ARCH_ESP32)
+    SemaphoreHandle_t _mutex;
+  #else
+    std::mutex _mutex;
+  #endif
+#endif
+};
+
+/* Holds the mutex until the end of the scope */
+class ConnectionHandlerLock
+{
+  public:
+
+    ConnectionHandlerLock(ConnectionHandlerMutex & mutex) : _mutex(mutex) { _mutex.lock(); }
+    ~ConnectionHandlerLock() { _mutex.unlock(); }
+
+  private:
+
+    ConnectionHandlerMutex & _mutex;
+};
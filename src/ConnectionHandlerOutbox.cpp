@@ -0,0 +1,530 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerOutbox.h"
+#include "ConnectionHandlerInterface.h"
+#if defined(BOARD_HAS_LORA)
+#include "LoRaConnectionHandler.h"
+#endif
+#include "ConnectionHandlerDebug.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+static uint32_t const OUTBOX_SECTOR_MAGIC = 0x3158424F; /* "OBX1" */
+static uint8_t  const OUTBOX_RECORD_MARKER = 0xA5;
+static uint8_t  const OUTBOX_RECORD_PENDING = 0xFF;
+static uint8_t  const OUTBOX_RECORD_SENT = 0x00;
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+/* Flash log layout: every sector starts with a SectorHeader, the sequence number
+ * giving the order in which the sectors were written, followed by records made
+ * of a RecordHeader and the data padded to 4 bytes. A record doesn't span two
+ * sectors. Delivered records are marked clearing their state byte.
+ */
+struct SectorHeader {
+  uint32_t magic;
+  uint32_t seq;
+};
+
+struct RecordHeader {
+  uint16_t length;
+  uint8_t  marker;
+  uint8_t  state;
+  uint32_t crc;     /* CRC-32 of the data */
+};
+
+/******************************************************************************
+  LOCAL MODULE FUNCTIONS
+ ******************************************************************************/
+
+static uint32_t crc32(const void * data, size_t const len, uint32_t crc = 0)
+{
+  const uint8_t * bytes = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= bytes[i];
+    for (int b = 0; b < 8; b++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static uint32_t record_size(uint16_t const length)
+{
+  return sizeof(RecordHeader) + ((length + 3) & ~3UL);
+}
+
+/******************************************************************************
+  CTOR/DTOR
+ ******************************************************************************/
+
+Outbox::Outbox()
+: _send{nullptr}
+, _transport{Transport::NONE}
+, _host{nullptr}
+, _port{0}
+#if !defined(BOARD_HAS_LORA)
+, _client{nullptr}
+, _udp{nullptr}
+, _socket_adapter{NetworkAdapter::NONE}
+#endif
+, _ring_head{0}
+, _ring_used{0}
+, _use_flash{false}
+, _log_head{0}
+, _log_tail{0}
+, _log_seq{0}
+, _drain_us{0}
+, _drained_bytes{0}
+{
+  memset(&_flash, 0, sizeof(_flash));
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+/******************************************************************************
+  PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+
+bool Outbox::begin(OutboxFlash const & flash)
+{
+  if (flash.sector_size <= sizeof(SectorHeader) + record_size(CONNECTION_HANDLER_OUTBOX_MAX_RECORD) ||
+      flash.size / flash.sector_size < 2) {
+    DEBUG_ERROR(F("Outbox flash area too small"));
+    return false;
+  }
+
+  clear();
+  _flash = flash;
+  _use_flash = logRecover();
+  if (!_use_flash) {
+    DEBUG_ERROR(F("Outbox flash log not readable, using RAM"));
+  }
+  return _use_flash;
+}
+
+#if !defined(BOARD_HAS_LORA)
+void Outbox::setUDPDestination(const char * host, uint16_t const port)
+{
+  _transport = Transport::UDP;
+  _host = host;
+  _port = port;
+}
+
+void Outbox::setTCPDestination(const char * host, uint16_t const port)
+{
+  _transport = Transport::TCP;
+  _host = host;
+  _port = port;
+}
+#endif
+
+bool Outbox::push(const uint8_t * data, size_t const size)
+{
+  if (size == 0 || size > CONNECTION_HANDLER_OUTBOX_MAX_RECORD || size + 2 > CONNECTION_HANDLER_OUTBOX_SIZE) {
+    _stats.dropped++;
+    return false;
+  }
+
+  if (_use_flash) {
+    if (!logAppend(data, size)) {
+      _stats.dropped++;
+      return false;
+    }
+  } else {
+    /* The oldest records make room for the new one */
+    while (CONNECTION_HANDLER_OUTBOX_SIZE - _ring_used < size + 2) {
+      _stats.dropped++;
+      pop();
+    }
+    uint8_t const length[2] = { static_cast<uint8_t>(size), static_cast<uint8_t>(size >> 8) };
+    ringWrite(_ring_head, length, 2);
+    ringWrite(_ring_head + 2, data, size);
+    _ring_head = (_ring_head + size + 2) % CONNECTION_HANDLER_OUTBOX_SIZE;
+    _ring_used += size + 2;
+    _stats.pending++;
+    _stats.backlog += size;
+  }
+
+  _stats.queued++;
+  return true;
+}
+
+void Outbox::clear()
+{
+  while (_stats.pending > 0) {
+    _stats.dropped++;
+    pop();
+  }
+}
+
+OutboxStats Outbox::getStats() const
+{
+  OutboxStats stats = _stats;
+  stats.throughput = _drain_us > 0 ? static_cast<uint32_t>(_drained_bytes * 1000000ULL / _drain_us) : 0;
+  return stats;
+}
+
+void Outbox::drain(ConnectionHandler & handler, NetworkConnectionState const state)
+{
+#if !defined(BOARD_HAS_LORA)
+  /* The sockets are set up again on the next connection, or taken from the pool
+   * of the new interface when a MultiConnectionHandler changes route.
+   */
+  if ((_client != nullptr || _udp != nullptr) &&
+      (state != NetworkConnectionState::CONNECTED || handler.getRoutedAdapter() != _socket_adapter)) {
+    releaseSockets(handler);
+  }
+#endif
+
+  if (state != NetworkConnectionState::CONNECTED) {
+    return;
+  }
+
+  if (_stats.pending == 0) {
+    return;
+  }
+
+  unsigned long const start = millis();
+  unsigned long const start_us = micros();
+
+  while (_stats.pending > 0 && millis() - start < CONNECTION_HANDLER_OUTBOX_DRAIN_TIME) {
+    int const size = peek(_record);
+    if (size < 0) {
+      /* Corrupted in flash */
+      _stats.dropped++;
+      pop();
+      continue;
+    }
+
+    int const result = send(handler, _record, size);
+    if (result == 0) {
+      break;
+    }
+    if (result > 0) {
+      _stats.sent++;
+      _drained_bytes += size;
+    } else {
+      _stats.dropped++;
+    }
+    pop();
+  }
+
+  _drain_us += micros() - start_us;
+}
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+int Outbox::send(ConnectionHandler & handler, const uint8_t * data, size_t const size)
+{
+  if (_send != nullptr) {
+    return _send(handler, data, size);
+  }
+
+#if defined(BOARD_HAS_LORA)
+  int const result = handler.write(data, size);
+  if (result > 0) {
+    return 1;
+  }
+  /* Doesn't fit a frame at the current data rate, it never will if the rate is the lowest */
+  return result == LoRaCommunicationError::LORA_ERROR_MAX_PACKET_SIZE ? -1 : 0;
+#else
+  /* Only pooled sockets are used, getUDP()/getClient() belong to the application
+   * and may be carrying its own stream: without a free one the records wait.
+   */
+  if (_transport == Transport::UDP) {
+    if (_udp == nullptr) {
+      _udp = handler.acquireUDP();
+      if (_udp == nullptr) {
+        return 0;
+      }
+      _socket_adapter = handler.getRoutedAdapter();
+      _udp->begin(0);
+    }
+
+    IPAddress ip;
+    if (handler.resolve(_host, ip) != 1) {
+      return 0;
+    }
+    if (_udp->beginPacket(ip, _port) == 1 && _udp->write(data, size) == size && _udp->endPacket() == 1) {
+      return 1;
+    }
+    return 0;
+  }
+
+  if (_transport == Transport::TCP) {
+    if (_client == nullptr) {
+      _client = handler.acquireClient();
+      if (_client == nullptr) {
+        return 0;
+      }
+      _socket_adapter = handler.getRoutedAdapter();
+    }
+
+    if (!_client->connected() && handler.connectClient(*_client, _host, _port) != 1) {
+      return 0;
+    }
+    if (_client->write(data, size) == size) {
+      return 1;
+    }
+    /* Partially written, the whole record is sent again on a new connection */
+    _client->stop();
+    return 0;
+  }
+
+  return 0;
+#endif
+}
+
+#if !defined(BOARD_HAS_LORA)
+void Outbox::releaseSockets(ConnectionHandler & handler)
+{
+  if (_client != nullptr) {
+    _client->stop();
+    handler.releaseClient(_client);
+    _client = nullptr;
+  }
+  if (_udp != nullptr) {
+    _udp->stop();
+    handler.releaseUDP(_udp);
+    _udp = nullptr;
+  }
+  _socket_adapter = NetworkAdapter::NONE;
+}
+#endif
+
+int Outbox::peek(uint8_t * data)
+{
+  if (_use_flash) {
+    RecordHeader header;
+    if (!_flash.read(_log_tail, &header, sizeof(header)) || header.length > CONNECTION_HANDLER_OUTBOX_MAX_RECORD ||
+        !_flash.read(_log_tail + sizeof(header), data, header.length) || crc32(data, header.length) != header.crc) {
+      return -1;
+    }
+    return header.length;
+  }
+
+  size_t const tail = (_ring_head + CONNECTION_HANDLER_OUTBOX_SIZE - _ring_used) % CONNECTION_HANDLER_OUTBOX_SIZE;
+  uint8_t length[2];
+  ringRead(tail, length, 2);
+  size_t const size = length[0] | (length[1] << 8);
+  ringRead(tail + 2, data, size);
+  return size;
+}
+
+void Outbox::pop()
+{
+  if (_stats.pending == 0) {
+    return;
+  }
+
+  if (_use_flash) {
+    RecordHeader header;
+    _flash.read(_log_tail, &header, sizeof(header));
+    _flash.write(_log_tail + offsetof(RecordHeader, state), &OUTBOX_RECORD_SENT, 1);
+    _stats.backlog -= header.length <= _stats.backlog ? header.length : _stats.backlog;
+    _stats.pending--;
+    _log_tail = _stats.pending > 0 ? logNext(_log_tail) : _log_head;
+    return;
+  }
+
+  size_t const tail = (_ring_head + CONNECTION_HANDLER_OUTBOX_SIZE - _ring_used) % CONNECTION_HANDLER_OUTBOX_SIZE;
+  uint8_t length[2];
+  ringRead(tail, length, 2);
+  size_t const size = length[0] | (length[1] << 8);
+  _ring_used -= size + 2;
+  _stats.backlog -= size;
+  _stats.pending--;
+}
+
+void Outbox::ringWrite(size_t const offset, const uint8_t * data, size_t const size)
+{
+  for (size_t i = 0; i < size; i++) {
+    _ring[(offset + i) % CONNECTION_HANDLER_OUTBOX_SIZE] = data[i];
+  }
+}
+
+void Outbox::ringRead(size_t const offset, uint8_t * data, size_t const size) const
+{
+  for (size_t i = 0; i < size; i++) {
+    data[i] = _ring[(offset + i) % CONNECTION_HANDLER_OUTBOX_SIZE];
+  }
+}
+
+bool Outbox::logRecover()
+{
+  uint32_t const sectors = _flash.size / _flash.sector_size;
+  int32_t head_sector = -1;
+  SectorHeader sh;
+
+  _log_seq = 0;
+  for (uint32_t s = 0; s < sectors; s++) {
+    if (!_flash.read(s * _flash.sector_size, &sh, sizeof(sh))) {
+      return false;
+    }
+    if (sh.magic == OUTBOX_SECTOR_MAGIC && (head_sector < 0 || sh.seq > _log_seq)) {
+      head_sector = s;
+      _log_seq = sh.seq;
+    }
+  }
+
+  if (head_sector < 0) {
+    /* Blank or foreign area */
+    _log_head = 0;
+    return logOpenSector(0);
+  }
+
+  /* The head is right after the last record of the newest sector */
+  uint32_t const head_base = head_sector * _flash.sector_size;
+  _log_head = head_base + sizeof(SectorHeader);
+  while (_log_head - head_base + sizeof(RecordHeader) <= _flash.sector_size) {
+    RecordHeader header;
+    _flash.read(_log_head, &header, sizeof(header));
+    if (header.marker != OUTBOX_RECORD_MARKER || _log_head - head_base + record_size(header.length) > _flash.sector_size) {
+      break;
+    }
+    _log_head += record_size(header.length);
+  }
+
+  /* Walk the sectors from the oldest one, the tail is the first pending record */
+  bool tail_found = false;
+  uint32_t last_seq = 0;
+  for (uint32_t i = 0; i < sectors; i++) {
+    int32_t sector = -1;
+    uint32_t seq = 0;
+    for (uint32_t s = 0; s < sectors; s++) {
+      _flash.read(s * _flash.sector_size, &sh, sizeof(sh));
+      if (sh.magic == OUTBOX_SECTOR_MAGIC && (i == 0 || sh.seq > last_seq) && (sector < 0 || sh.seq < seq)) {
+        sector = s;
+        seq = sh.seq;
+      }
+    }
+    if (sector < 0) {
+      break;
+    }
+    last_seq = seq;
+
+    uint32_t const base = sector * _flash.sector_size;
+    uint32_t address = base + sizeof(SectorHeader);
+    while (address - base + sizeof(RecordHeader) <= _flash.sector_size && address != _log_head) {
+      RecordHeader header;
+      _flash.read(address, &header, sizeof(header));
+      if (header.marker != OUTBOX_RECORD_MARKER || address - base + record_size(header.length) > _flash.sector_size) {
+        break;
+      }
+      if (header.state == OUTBOX_RECORD_PENDING) {
+        if (!tail_found) {
+          _log_tail = address;
+          tail_found = true;
+        }
+        _stats.pending++;
+        _stats.backlog += header.length;
+      }
+      address += record_size(header.length);
+    }
+  }
+
+  if (!tail_found) {
+    _log_tail = _log_head;
+  }
+  DEBUG_INFO(F("Outbox: %d records recovered from flash"), _stats.pending);
+  return true;
+}
+
+bool Outbox::logAppend(const uint8_t * data, size_t const size)
+{
+  uint32_t const footprint = record_size(size);
+  uint32_t const offset = _log_head % _flash.sector_size;
+
+  if (offset == 0 || offset + footprint > _flash.sector_size) {
+    uint32_t const sectors = _flash.size / _flash.sector_size;
+    if (!logOpenSector(((_log_head - 1) / _flash.sector_size + 1) % sectors)) {
+      return false;
+    }
+  }
+
+  /* Header first, a record interrupted by a reset is detected by its CRC */
+  RecordHeader const header = { static_cast<uint16_t>(size), OUTBOX_RECORD_MARKER, OUTBOX_RECORD_PENDING, crc32(data, size) };
+  if (!_flash.write(_log_head, &header, sizeof(header)) ||
+      !_flash.write(_log_head + sizeof(header), data, size)) {
+    return false;
+  }
+
+  if (_stats.pending == 0) {
+    _log_tail = _log_head;
+  }
+  _log_head += footprint;
+  _stats.pending++;
+  _stats.backlog += size;
+  return true;
+}
+
+bool Outbox::logOpenSector(uint32_t const sector)
+{
+  uint32_t const base = sector * _flash.sector_size;
+
+  /* The records still pending in the sector are lost */
+  while (_stats.pending > 0 && _log_tail / _flash.sector_size == sector) {
+    _stats.dropped++;
+    pop();
+  }
+
+  if (!_flash.erase(base)) {
+    return false;
+  }
+  _stats.erases++;
+
+  SectorHeader const header = { OUTBOX_SECTOR_MAGIC, ++_log_seq };
+  if (!_flash.write(base, &header, sizeof(header))) {
+    return false;
+  }
+
+  _log_head = base + sizeof(SectorHeader);
+  if (_stats.pending == 0) {
+    _log_tail = _log_head;
+  }
+  return true;
+}
+
+uint32_t Outbox::logNext(uint32_t const address)
+{
+  RecordHeader header;
+  _flash.read(address, &header, sizeof(header));
+
+  uint32_t const next = address + record_size(header.length);
+  if (next == _log_head) {
+    return next;
+  }
+
+  uint32_t const offset = next % _flash.sector_size;
+  bool const same_sector = header.length <= CONNECTION_HANDLER_OUTBOX_MAX_RECORD &&
+                           address / _flash.sector_size == next / _flash.sector_size;
+  if (same_sector && offset != 0 && offset + sizeof(RecordHeader) <= _flash.sector_size) {
+    _flash.read(next, &header, sizeof(header));
+    if (header.marker == OUTBOX_RECORD_MARKER) {
+      return next;
+    }
+  }
+
+  /* Continue with the first record of the following sector */
+  uint32_t const sectors = _flash.size / _flash.sector_size;
+  return ((address / _flash.sector_size + 1) % sectors) * _flash.sector_size + sizeof(SectorHeader);
+}
@@ -0,0 +1,169 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include <Client.h>
+#include <Udp.h>
+#include "ConnectionHandlerDefinitions.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+/* RAM ring, each record takes 2 more bytes for its length */
+#ifndef CONNECTION_HANDLER_OUTBOX_SIZE
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_OUTBOX_SIZE 128
+  #else
+    #define CONNECTION_HANDLER_OUTBOX_SIZE 1024
+  #endif
+#endif
+
+#ifndef CONNECTION_HANDLER_OUTBOX_MAX_RECORD
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_OUTBOX_MAX_RECORD 64
+  #else
+    #define CONNECTION_HANDLER_OUTBOX_MAX_RECORD 256
+  #endif
+#endif
+
+/* Time spent draining records in a single check() call, ms */
+#ifndef CONNECTION_HANDLER_OUTBOX_DRAIN_TIME
+  #define CONNECTION_HANDLER_OUTBOX_DRAIN_TIME 50
+#endif
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+class ConnectionHandler;
+
+/* Send a record, returns 1 once sent, 0 to retry it later and a negative value
+ * to drop it, e.g. if it is rejected by the far end.
+ */
+typedef int (*OnOutboxSend)(ConnectionHandler & handler, const uint8_t * data, size_t const size);
+
+/* Flash area of the log, addresses are relative to its start. write() has to be
+ * able to clear bits of data already written, as NOR flash does, erase() sets a
+ * whole sector starting at the given address to 0xFF.
+ */
+struct OutboxFlash {
+  bool (*read)(uint32_t const address, void * data, size_t const size);
+  bool (*write)(uint32_t const address, const void * data, size_t const size);
+  bool (*erase)(uint32_t const address);
+  uint32_t size;
+  uint32_t sector_size;
+};
+
+struct OutboxStats {
+  uint32_t queued;        /* records accepted by push() */
+  uint32_t sent;          /* records delivered */
+  uint32_t dropped;       /* records lost: too large, overwritten when full or refused */
+  uint32_t pending;       /* records waiting, the backlog */
+  uint32_t backlog;       /* bytes waiting */
+  uint32_t throughput;    /* bytes/s while draining */
+  uint32_t erases;        /* flash sectors erased */
+};
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** Outbox class
+ * Store-and-forward queue of outbound records attached to a ConnectionHandler
+ * with setOutbox(). Records are pushed in any state and drained by check() in
+ * the application thread as long as the handler is CONNECTED, and only while
+ * its ConnectionHandlerThread, if any, is not running the state machine: with
+ * write() on LoRa, through a UDP or Client socket taken from the handler pool to
+ * the given destination otherwise, or with a custom sender. getUDP() and
+ * getClient() are never used, the records wait while no pooled socket is free.
+ * When full the oldest records are dropped.
+ * Records are kept in a RAM ring unless a flash area is given with begin(): it
+ * is then used as an append-only log written sector after sector, so that the
+ * erases are spread over the whole area, and the records not delivered yet are
+ * recovered at boot.
+ */
+class Outbox
+{
+  public:
+
+    Outbox();
+
+    /* Use a flash log in place of the RAM ring, the area needs at least 2 sectors */
+    bool begin(OutboxFlash const & flash);
+
+#if !defined(BOARD_HAS_LORA)
+    /* The records are sent one per datagram, or written to a connection kept open */
+    void setUDPDestination(const char * host, uint16_t const port);
+    void setTCPDestination(const char * host, uint16_t const port);
+#endif
+    inline void setSender(OnOutboxSend send) { _send = send; }
+
+    bool push(const uint8_t * data, size_t const size);
+    void clear();
+
+    inline size_t pending() const { return _stats.pending; }
+    OutboxStats getStats() const;
+
+    /* Called by ConnectionHandler::check() */
+    void drain(ConnectionHandler & handler, NetworkConnectionState const state);
+
+  private:
+
+    enum class Transport { NONE, UDP, TCP };
+
+    int send(ConnectionHandler & handler, const uint8_t * data, size_t const size);
+#if !defined(BOARD_HAS_LORA)
+    void releaseSockets(ConnectionHandler & handler);
+#endif
+    int peek(uint8_t * data);
+    void pop();
+
+    void ringWrite(size_t const offset, const uint8_t * data, size_t const size);
+    void ringRead(size_t const offset, uint8_t * data, size_t const size) const;
+
+    bool logRecover();
+    bool logAppend(const uint8_t * data, size_t const size);
+    bool logOpenSector(uint32_t const sector);
+    uint32_t logNext(uint32_t const address);
+
+    OnOutboxSend _send;
+    Transport _transport;
+    const char * _host;
+    uint16_t _port;
+#if !defined(BOARD_HAS_LORA)
+    Client * _client;
+    UDP * _udp;
+    NetworkAdapter _socket_adapter;  /* interface the pooled _client/_udp belong to */
+#endif
+
+    /* RAM ring */
+    uint8_t _ring[CONNECTION_HANDLER_OUTBOX_SIZE];
+    size_t _ring_head;
+    size_t _ring_used;
+
+    /* Flash log */
+    OutboxFlash _flash;
+    bool _use_flash;
+    uint32_t _log_head;
+    uint32_t _log_tail;
+    uint32_t _log_seq;
+
+    uint8_t _record[CONNECTION_HANDLER_OUTBOX_MAX_RECORD];
+    uint64_t _drain_us;
+    uint64_t _drained_bytes;
+    OutboxStats _stats;
+};
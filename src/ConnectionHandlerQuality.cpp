@@ -0,0 +1,82 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerQuality.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+/* The latency score drops linearly from 100 at QUALITY_RTT_GOOD to 0 at QUALITY_RTT_BAD, ms */
+static unsigned long const QUALITY_RTT_GOOD = 50;
+static unsigned long const QUALITY_RTT_BAD  = 1000;
+
+/* Each connection loss in the window costs this much stability */
+static uint8_t const QUALITY_FLAP_PENALTY = 25;
+
+/* Weights of latency, delivery, link and stability */
+static uint8_t const QUALITY_WEIGHTS[] = { 30, 30, 20, 20 };
+
+/******************************************************************************
+  FUNCTION DEFINITION
+ ******************************************************************************/
+
+uint8_t defaultCostWeight(NetworkAdapter const adapter)
+{
+  switch (adapter) {
+    case NetworkAdapter::NB:
+    case NetworkAdapter::GSM:
+    case NetworkAdapter::CATM1:
+    case NetworkAdapter::CELL:     return 30;
+    case NetworkAdapter::LORA:     return 50;
+    default:                       return 0;
+  }
+}
+
+ConnectionQuality computeQuality(unsigned long const rtt_avg, uint8_t const sent, uint8_t const received,
+                                 int const link, uint8_t const flaps, uint8_t const cost)
+{
+  ConnectionQuality q;
+
+  if (sent == 0) {
+    q.latency = CONNECTION_HANDLER_QUALITY_UNKNOWN;
+    q.delivery = CONNECTION_HANDLER_QUALITY_UNKNOWN;
+  } else {
+    q.delivery = 100 * received / sent;
+    if (received == 0 || rtt_avg >= QUALITY_RTT_BAD) {
+      q.latency = 0;
+    } else if (rtt_avg <= QUALITY_RTT_GOOD) {
+      q.latency = 100;
+    } else {
+      q.latency = 100 * (QUALITY_RTT_BAD - rtt_avg) / (QUALITY_RTT_BAD - QUALITY_RTT_GOOD);
+    }
+  }
+
+  q.link = link < 0 ? CONNECTION_HANDLER_QUALITY_UNKNOWN : (link > 100 ? 100 : link);
+  q.stability = flaps * QUALITY_FLAP_PENALTY >= 100 ? 0 : 100 - flaps * QUALITY_FLAP_PENALTY;
+
+  uint8_t const components[] = { q.latency, q.delivery, q.link, q.stability };
+  unsigned int total = 0;
+  unsigned int weights = 0;
+  for (size_t i = 0; i < sizeof(components); i++) {
+    if (components[i] != CONNECTION_HANDLER_QUALITY_UNKNOWN) {
+      total += components[i] * QUALITY_WEIGHTS[i];
+      weights += QUALITY_WEIGHTS[i];
+    }
+  }
+
+  /* The stability is always known, weights is never 0 */
+  q.score = total * (100 - (cost > 100 ? 100 : cost)) / (weights * 100);
+  return q;
+}
@@ -0,0 +1,65 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "ConnectionHandlerDefinitions.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#define CONNECTION_HANDLER_QUALITY_UNKNOWN 0xFF
+
+/* Points a candidate interface has to score above the one in use to replace it */
+#ifndef CONNECTION_HANDLER_QUALITY_HYSTERESIS
+  #define CONNECTION_HANDLER_QUALITY_HYSTERESIS 10
+#endif
+
+/* Connection losses older than the window don't count against the stability */
+#ifndef CONNECTION_HANDLER_QUALITY_FLAP_WINDOW
+  #define CONNECTION_HANDLER_QUALITY_FLAP_WINDOW 600000UL
+#endif
+
+#define CONNECTION_HANDLER_QUALITY_FLAPS 4
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+/* Each component is scored from 0 to 100, or CONNECTION_HANDLER_QUALITY_UNKNOWN
+ * when there is nothing to base it on. The score is their weighted average,
+ * unknown components left out, reduced by the cost weight of the interface.
+ */
+struct ConnectionQuality {
+  uint8_t score;      /* 0 while the interface is not CONNECTED */
+  uint8_t latency;    /* average RTT of the last measurement */
+  uint8_t delivery;   /* probes answered in the last measurement */
+  uint8_t link;       /* signal or link status reported by the interface */
+  uint8_t stability;  /* connection losses in the last CONNECTION_HANDLER_QUALITY_FLAP_WINDOW ms */
+};
+
+/******************************************************************************
+  FUNCTION DECLARATION
+ ******************************************************************************/
+
+/* Cost of the traffic on the given adapter, from 0 (free) to 100: metered
+ * cellular links are penalised so that a comparable WiFi or Ethernet link wins.
+ */
+uint8_t defaultCostWeight(NetworkAdapter const adapter);
+
+/* rtt_avg in ms, link from 0 to 100 or negative if unknown */
+ConnectionQuality computeQuality(unsigned long const rtt_avg, uint8_t const sent, uint8_t const received,
+                                 int const link, uint8_t const flaps, uint8_t const cost);
@@ -0,0 +1,167 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerSessionCache.h"
+
+/******************************************************************************
+  CTOR/DTOR
+ ******************************************************************************/
+
+TLSSessionCache::TLSSessionCache()
+: _use_counter{0}
+, _loaded{false}
+, _load{nullptr}
+, _save{nullptr}
+, _stats{0, 0, 0, 0}
+{
+  memset(_entries, 0, sizeof(_entries));
+}
+
+/******************************************************************************
+  PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+
+void TLSSessionCache::setPersistence(OnTLSSessionCacheLoad load, OnTLSSessionCacheSave save)
+{
+  _load = load;
+  _save = save;
+  _loaded = false;
+}
+
+bool TLSSessionCache::lookup(const char * host, uint16_t const port, TLSSession & session)
+{
+  load();
+
+  Entry * entry = find(host, port);
+  if (entry == nullptr) {
+    _stats.misses++;
+    return false;
+  }
+
+  entry->last_use = ++_use_counter;
+  session = entry->session;
+  _stats.hits++;
+  return true;
+}
+
+void TLSSessionCache::store(const char * host, uint16_t const port, TLSSession const & session)
+{
+  if (strlen(host) >= CONNECTION_HANDLER_TLS_SESSION_HOST_SIZE) {
+    return;
+  }
+
+  load();
+
+  Entry * entry = find(host, port);
+
+  if (entry == nullptr) {
+    /* Take a free slot or replace the least recently used session */
+    entry = &_entries[0];
+    for (size_t i = 1; i < CONNECTION_HANDLER_TLS_SESSION_CACHE_SIZE && entry->key != 0; i++) {
+      if (_entries[i].key == 0 || _entries[i].last_use < entry->last_use) {
+        entry = &_entries[i];
+      }
+    }
+  } else if (memcmp(&entry->session, &session, sizeof(session)) == 0) {
+    /* The server resumed the cached session, nothing changed */
+    entry->last_use = ++_use_counter;
+    return;
+  }
+
+  memset(entry, 0, sizeof(Entry));
+  entry->key = key(host, port);
+  entry->port = port;
+  strcpy(entry->host, host);
+  entry->last_use = ++_use_counter;
+  entry->session = session;
+  _stats.stores++;
+  save();
+}
+
+void TLSSessionCache::invalidate(const char * host, uint16_t const port)
+{
+  Entry * entry = find(host, port);
+  if (entry != nullptr) {
+    memset(entry, 0, sizeof(Entry));
+    _stats.invalidations++;
+    save();
+  }
+}
+
+void TLSSessionCache::clear()
+{
+  memset(_entries, 0, sizeof(_entries));
+  save();
+}
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+uint32_t TLSSessionCache::key(const char * host, uint16_t const port)
+{
+  /* FNV-1a over host and port, 0 marks a free slot */
+  uint32_t hash = 2166136261UL;
+  for (; *host != '\0'; host++) {
+    hash = (hash ^ static_cast<uint8_t>(*host)) * 16777619UL;
+  }
+  hash = (hash ^ (port & 0xFF)) * 16777619UL;
+  hash = (hash ^ (port >> 8)) * 16777619UL;
+  return hash != 0 ? hash : 1;
+}
+
+TLSSessionCache::Entry * TLSSessionCache::find(const char * host, uint16_t const port)
+{
+  /* The hash only skips the comparison of the host names, a collision must
+   * never hand the master secret of a server to another one.
+   */
+  uint32_t const k = key(host, port);
+  for (size_t i = 0; i < CONNECTION_HANDLER_TLS_SESSION_CACHE_SIZE; i++) {
+    if (_entries[i].key == k && _entries[i].port == port && strcmp(_entries[i].host, host) == 0) {
+      return &_entries[i];
+    }
+  }
+  return nullptr;
+}
+
+void TLSSessionCache::load()
+{
+  if (_loaded || _load == nullptr) {
+    return;
+  }
+  _loaded = true;
+
+  if (!_load(reinterpret_cast<uint8_t *>(_entries), sizeof(_entries))) {
+    memset(_entries, 0, sizeof(_entries));
+    return;
+  }
+
+  /* Discard anything that cannot be a valid session */
+  for (size_t i = 0; i < CONNECTION_HANDLER_TLS_SESSION_CACHE_SIZE; i++) {
+    if (_entries[i].session.session_id_len > sizeof(_entries[i].session.session_id) ||
+        memchr(_entries[i].host, '\0', sizeof(_entries[i].host)) == nullptr) {
+      memset(&_entries[i], 0, sizeof(Entry));
+    }
+    if (_entries[i].last_use > _use_counter) {
+      _use_counter = _entries[i].last_use;
+    }
+  }
+}
+
+void TLSSessionCache::save()
+{
+  if (_save != nullptr) {
+    _save(reinterpret_cast<uint8_t const *>(_entries), sizeof(_entries));
+  }
+}
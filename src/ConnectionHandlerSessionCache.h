@@ -0,0 +1,106 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include <Arduino.h>
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#ifndef CONNECTION_HANDLER_TLS_SESSION_CACHE_SIZE
+  #define CONNECTION_HANDLER_TLS_SESSION_CACHE_SIZE 2
+#endif
+
+/* Longest host name cached, sessions of longer ones are not kept */
+#ifndef CONNECTION_HANDLER_TLS_SESSION_HOST_SIZE
+  #define CONNECTION_HANDLER_TLS_SESSION_HOST_SIZE 64
+#endif
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+/* Parameters needed to resume a TLS session, the layout matches
+ * br_ssl_session_parameters so that it can be handed to BearSSL as is.
+ */
+struct TLSSession {
+  uint8_t  session_id[32];
+  uint8_t  session_id_len;
+  uint16_t version;
+  uint16_t cipher_suite;
+  uint8_t  master_secret[48];
+};
+
+struct TLSSessionCacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t stores;
+  uint32_t invalidations;
+};
+
+/* Optional persistence of the whole cache, e.g. in flash or in a file */
+typedef bool (*OnTLSSessionCacheLoad)(uint8_t * data, size_t const size);
+typedef bool (*OnTLSSessionCacheSave)(uint8_t const * data, size_t const size);
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** TLSSessionCache class
+ * A fixed-size RAM cache of TLS sessions indexed by endpoint (host and port).
+ * The secure client layer, WiFiConnectionHandler::connectSecure() on ESP8266,
+ * looks a session up before the handshake in order to try an abbreviated
+ * one first, stores the session negotiated by every full handshake and
+ * invalidates it when the connection fails. When the cache is full the least
+ * recently used session is replaced.
+ */
+class TLSSessionCache
+{
+  public:
+
+    TLSSessionCache();
+
+    void setPersistence(OnTLSSessionCacheLoad load, OnTLSSessionCacheSave save);
+
+    bool lookup(const char * host, uint16_t const port, TLSSession & session);
+    void store(const char * host, uint16_t const port, TLSSession const & session);
+    void invalidate(const char * host, uint16_t const port);
+    void clear();
+
+    inline TLSSessionCacheStats getStats() const { return _stats; }
+
+  private:
+
+    struct Entry {
+      uint32_t   key;       /* 0 marks a free slot */
+      uint32_t   last_use;
+      uint16_t   port;
+      char       host[CONNECTION_HANDLER_TLS_SESSION_HOST_SIZE];
+      TLSSession session;
+    };
+
+    static uint32_t key(const char * host, uint16_t const port);
+    Entry * find(const char * host, uint16_t const port);
+    void load();
+    void save();
+
+    Entry _entries[CONNECTION_HANDLER_TLS_SESSION_CACHE_SIZE];
+    uint32_t _use_counter;
+    bool _loaded;
+    OnTLSSessionCacheLoad _load;
+    OnTLSSessionCacheSave _save;
+    TLSSessionCacheStats _stats;
+};
@@ -0,0 +1,155 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include <Arduino.h>
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#ifndef CONNECTION_HANDLER_CLIENT_POOL_SIZE
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_CLIENT_POOL_SIZE 0
+  #else
+    #define CONNECTION_HANDLER_CLIENT_POOL_SIZE 2
+  #endif
+#endif
+
+#ifndef CONNECTION_HANDLER_UDP_POOL_SIZE
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_UDP_POOL_SIZE 0
+  #else
+    #define CONNECTION_HANDLER_UDP_POOL_SIZE 1
+  #endif
+#endif
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+struct SocketPoolStats {
+  uint8_t  size;          // number of sockets in the pool
+  uint8_t  in_use;        // sockets currently acquired
+  uint8_t  high_water;    // maximum number of sockets acquired at the same time
+  uint32_t acquired;      // successful acquire() calls
+  uint32_t exhausted;     // acquire() calls failed because all sockets were in use
+  uint32_t invalidated;   // sockets stopped because the connection was lost
+};
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/* Type erased access to a pool, Base is either Client or UDP */
+template <typename Base>
+class SocketPoolInterface
+{
+  public:
+    virtual ~SocketPoolInterface() {}
+
+    virtual Base * acquire() = 0;
+    virtual bool release(Base * socket) = 0;
+    virtual void invalidate() = 0;
+
+    inline SocketPoolStats stats() const { return _stats; }
+
+  protected:
+    SocketPoolStats _stats = {0, 0, 0, 0, 0, 0};
+};
+
+/** SocketPool class
+ * A bounded, statically allocated set of N sockets of the concrete type T
+ * provided by a network library (e.g. WiFiClient, EthernetUDP). Sockets are
+ * handed out with acquire() and given back with release(), invalidate()
+ * stops all the acquired ones when the connection is lost: their owners have
+ * to reconnect them and still have to release them.
+ */
+template <typename Base, typename T, size_t N>
+class SocketPool : public SocketPoolInterface<Base>
+{
+  public:
+    SocketPool() {
+      this->_stats.size = N;
+      for (size_t i = 0; i < N; i++) {
+        _used[i] = false;
+      }
+    }
+
+    Base * acquire() override {
+      for (size_t i = 0; i < N; i++) {
+        if (!_used[i]) {
+          _used[i] = true;
+          this->_stats.in_use++;
+          this->_stats.acquired++;
+          if (this->_stats.in_use > this->_stats.high_water) {
+            this->_stats.high_water = this->_stats.in_use;
+          }
+          return &_sockets[i];
+        }
+      }
+      this->_stats.exhausted++;
+      return nullptr;
+    }
+
+    bool release(Base * socket) override {
+      for (size_t i = 0; i < N; i++) {
+        if (_used[i] && socket == &_sockets[i]) {
+          _sockets[i].stop();
+          _used[i] = false;
+          this->_stats.in_use--;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void invalidate() override {
+      for (size_t i = 0; i < N; i++) {
+        if (_used[i]) {
+          _sockets[i].stop();
+          this->_stats.invalidated++;
+        }
+      }
+    }
+
+    /* The socket with its concrete type if it belongs to the pool, nullptr otherwise */
+    T * find(Base * socket) {
+      for (size_t i = 0; i < N; i++) {
+        if (socket == &_sockets[i]) {
+          return &_sockets[i];
+        }
+      }
+      return nullptr;
+    }
+
+  private:
+    T _sockets[N];
+    bool _used[N];
+};
+
+/* An empty pool, used when the pool size is configured to 0 */
+template <typename Base, typename T>
+class SocketPool<Base, T, 0> : public SocketPoolInterface<Base>
+{
+  public:
+    Base * acquire() override {
+      this->_stats.exhausted++;
+      return nullptr;
+    }
+    bool release(Base *) override { return false; }
+    void invalidate() override { }
+    T * find(Base *) { return nullptr; }
+};
@@ -0,0 +1,315 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerDefinitions.h"
+
+#if defined(BOARD_HAS_RTOS) /* Only compile if the platform provides threads */
+#include "ConnectionHandlerThread.h"
+#include "ConnectionHandlerDebug.h"
+
+/******************************************************************************
+  CTOR/DTOR
+ ******************************************************************************/
+
+ConnectionHandlerThread::ConnectionHandlerThread(ConnectionHandler & handler)
+: _handler{handler}
+, _running{false}
+, _finished{true}
+, _state{NetworkConnectionState::INIT}
+, _post{nullptr}
+, _events_head{0}
+, _events_tail{0}
+#if defined(ARDUINO_ARCH_MBED)
+, _thread{nullptr}
+#elif defined(ARDUINO_ARCH_ESP32)
+, _task{nullptr}
+, _mutex{xSemaphoreCreateMutex()}
+#else
+, _wake{false}
+#endif
+{
+
+}
+
+ConnectionHandlerThread::~ConnectionHandlerThread()
+{
+  end();
+}
+
+/******************************************************************************
+  PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+
+bool ConnectionHandlerThread::begin()
+{
+  if (_running) {
+    return true;
+  }
+  if (_handler._thread == this) {
+    /* Stopped and not ended yet */
+    return false;
+  }
+
+  _running = true;
+  _finished = false;
+  _handler._thread = this;
+
+  /* The new thread waits for the handles below to be assigned before
+   * running the state machine for the first time.
+   */
+  lock();
+
+  bool started;
+#if defined(ARDUINO_ARCH_MBED)
+  _thread = new rtos::Thread(osPriorityNormal, CONNECTION_HANDLER_THREAD_STACK_SIZE, nullptr, "ConnectionHandler");
+  started = _thread->start(mbed::callback(this, &ConnectionHandlerThread::run)) == osOK;
+  if (!started) {
+    delete _thread;
+    _thread = nullptr;
+  }
+#elif defined(ARDUINO_ARCH_ESP32)
+  started = xTaskCreate(ConnectionHandlerThread::task, "ConnectionHandler",
+    CONNECTION_HANDLER_THREAD_STACK_SIZE, this, tskIDLE_PRIORITY + 1, &_task) == pdPASS;
+  if (!started) {
+    _task = nullptr;
+  }
+#else
+  _thread = std::thread(&ConnectionHandlerThread::run, this);
+  started = _thread.joinable();
+#endif
+
+  unlock();
+
+  if (!started) {
+    DEBUG_ERROR(F("Unable to start the connection handler thread"));
+    _handler._thread = nullptr;
+    _running = false;
+    _finished = true;
+    return false;
+  }
+
+  return true;
+}
+
+void ConnectionHandlerThread::end()
+{
+  /* The thread may have been stopped already */
+  if (_handler._thread != this) {
+    return;
+  }
+
+  stop();
+
+#if defined(ARDUINO_ARCH_MBED)
+  _thread->join();
+  delete _thread;
+  _thread = nullptr;
+#elif defined(ARDUINO_ARCH_ESP32)
+  /* The task deletes itself once it leaves its loop */
+  while (_task != nullptr) {
+    vTaskDelay(1);
+  }
+#else
+  _thread.join();
+#endif
+
+  _handler._thread = nullptr;
+  /* Events recorded and not yet dispatched are still delivered */
+  dispatch();
+}
+
+void ConnectionHandlerThread::stop()
+{
+  _running = false;
+  wake();
+}
+
+void ConnectionHandlerThread::dispatch()
+{
+  uint8_t tail = _events_tail.load();
+
+  while (tail != _events_head.load())
+  {
+    NetworkConnectionEvent const event = _events[tail];
+    tail = (tail + 1) % CONNECTION_HANDLER_THREAD_EVENT_QUEUE_SIZE;
+    _events_tail.store(tail);
+
+    switch (event)
+    {
+      case NetworkConnectionEvent::CONNECTED:    if (_handler._on_connect_event_callback)    _handler._on_connect_event_callback();    break;
+      case NetworkConnectionEvent::DISCONNECTED: if (_handler._on_disconnect_event_callback) _handler._on_disconnect_event_callback(); break;
+      case NetworkConnectionEvent::ERROR:        if (_handler._on_error_event_callback)      _handler._on_error_event_callback();      break;
+    }
+  }
+}
+
+void ConnectionHandlerThread::connect()
+{
+  lock();
+  _handler.connect();
+  unlock();
+  wake();
+}
+
+void ConnectionHandlerThread::disconnect()
+{
+  lock();
+  _handler.disconnect();
+  unlock();
+  wake();
+}
+
+bool ConnectionHandlerThread::updateSetting(const models::NetworkSetting& s)
+{
+  lock();
+  bool const res = _handler.updateSetting(s);
+  unlock();
+  wake();
+  return res;
+}
+
+bool ConnectionHandlerThread::isBackgroundThread()
+{
+#if defined(ARDUINO_ARCH_MBED)
+  return _thread != nullptr && rtos::ThisThread::get_id() == _thread->get_id();
+#elif defined(ARDUINO_ARCH_ESP32)
+  return _task != nullptr && xTaskGetCurrentTaskHandle() == _task;
+#else
+  return std::this_thread::get_id() == _thread.get_id();
+#endif
+}
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+void ConnectionHandlerThread::run()
+{
+  while (_running)
+  {
+    lock();
+    NetworkConnectionState const state = _handler.check();
+    unsigned long const interval = _handler._timeoutTable.intervals[static_cast<unsigned int>(state)];
+    unsigned long const elapsed = millis() - _handler._lastConnectionTickTime;
+    unlock();
+
+    _state.store(state);
+
+    /* Sleep until the interval of the current state is elapsed, connect(),
+     * disconnect() and updateSetting() wake the thread up earlier.
+     */
+    wait(elapsed > interval ? 1 : interval - elapsed + 1);
+  }
+
+  _finished = true;
+}
+
+void ConnectionHandlerThread::post(NetworkConnectionState const state)
+{
+  NetworkConnectionEvent event;
+
+  switch (state)
+  {
+    case NetworkConnectionState::CONNECTED:    event = NetworkConnectionEvent::CONNECTED;    break;
+    case NetworkConnectionState::DISCONNECTED: event = NetworkConnectionEvent::DISCONNECTED; break;
+    case NetworkConnectionState::ERROR:        event = NetworkConnectionEvent::ERROR;        break;
+    default:                                                                                 return;
+  }
+
+  if (_post != nullptr) {
+    _post(event);
+    return;
+  }
+
+  uint8_t const head = _events_head.load();
+  uint8_t const next = (head + 1) % CONNECTION_HANDLER_THREAD_EVENT_QUEUE_SIZE;
+
+  if (next == _events_tail.load()) {
+    /* Nobody is dispatching the events, drop the newest one */
+    return;
+  }
+
+  _events[head] = event;
+  _events_head.store(next);
+}
+
+#if defined(ARDUINO_ARCH_MBED)
+
+void ConnectionHandlerThread::lock()    { _mutex.lock(); }
+bool ConnectionHandlerThread::tryLock() { return _mutex.trylock(); }
+void ConnectionHandlerThread::unlock()  { _mutex.unlock(); }
+
+void ConnectionHandlerThread::wait(unsigned long const ms)
+{
+  rtos::ThisThread::flags_wait_any_for(0x1, std::chrono::milliseconds(ms));
+}
+
+void ConnectionHandlerThread::wake()
+{
+  if (_thread != nullptr) {
+    _thread->flags_set(0x1);
+  }
+}
+
+#elif defined(ARDUINO_ARCH_ESP32)
+
+void ConnectionHandlerThread::task(void * arg)
+{
+  ConnectionHandlerThread * self = static_cast<ConnectionHandlerThread *>(arg);
+  self->run();
+  self->_task = nullptr;
+  vTaskDelete(nullptr);
+}
+
+void ConnectionHandlerThread::lock()    { xSemaphoreTake(_mutex, portMAX_DELAY); }
+bool ConnectionHandlerThread::tryLock() { return xSemaphoreTake(_mutex, 0) == pdTRUE; }
+void ConnectionHandlerThread::unlock()  { xSemaphoreGive(_mutex); }
+
+void ConnectionHandlerThread::wait(unsigned long const ms)
+{
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+}
+
+void ConnectionHandlerThread::wake()
+{
+  if (_task != nullptr) {
+    xTaskNotifyGive(_task);
+  }
+}
+
+#else
+
+void ConnectionHandlerThread::lock()    { _mutex.lock(); }
+bool ConnectionHandlerThread::tryLock() { return _mutex.try_lock(); }
+void ConnectionHandlerThread::unlock()  { _mutex.unlock(); }
+
+void ConnectionHandlerThread::wait(unsigned long const ms)
+{
+  std::unique_lock<std::mutex> lock(_wait_mutex);
+  _wait_cond.wait_for(lock, std::chrono::milliseconds(ms), [this]{ return _wake; });
+  _wake = false;
+}
+
+void ConnectionHandlerThread::wake()
+{
+  {
+    std::lock_guard<std::mutex> lock(_wait_mutex);
+    _wake = true;
+  }
+  _wait_cond.notify_one();
+}
+
+#endif
+
+#endif /* BOARD_HAS_RTOS */
@@ -0,0 +1,140 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef ARDUINO_CONNECTION_HANDLER_THREAD_H_
+#define ARDUINO_CONNECTION_HANDLER_THREAD_H_
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerInterface.h"
+
+#if defined(BOARD_HAS_RTOS)
+
+#include <atomic>
+
+#if defined(ARDUINO_ARCH_MBED)
+  #include <mbed.h>
+#elif defined(ARDUINO_ARCH_ESP32)
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/task.h>
+  #include <freertos/semphr.h>
+#else
+  #include <thread>
+  #include <mutex>
+  #include <condition_variable>
+#endif
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#ifndef CONNECTION_HANDLER_THREAD_STACK_SIZE
+  #define CONNECTION_HANDLER_THREAD_STACK_SIZE 4096
+#endif
+
+#ifndef CONNECTION_HANDLER_THREAD_EVENT_QUEUE_SIZE
+  #define CONNECTION_HANDLER_THREAD_EVENT_QUEUE_SIZE 8
+#endif
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+typedef void (*OnNetworkEventPost)(NetworkConnectionEvent const event);
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** ConnectionHandlerThread class
+ * This class runs the state machine of a connectionHandler in a dedicated
+ * thread, waking it up according to the TimeoutTable intervals. Once started,
+ * calling check() from any other thread does not run the state machine: it
+ * invokes the callbacks of the events recorded meanwhile in the calling thread
+ * and returns the last published state.
+ */
+class ConnectionHandlerThread
+{
+  public:
+
+    ConnectionHandlerThread(ConnectionHandler & handler);
+    ~ConnectionHandlerThread();
+
+    bool begin();
+    void end();
+
+    /* Ask the thread to leave without waiting for a driver call in progress,
+     * end() or the destructor return at once after finished().
+     */
+    void stop();
+    inline bool finished() const { return _finished.load(); }
+
+    /* Last state published by the background thread, safe to call from any thread */
+    inline NetworkConnectionState state() const { return _state.load(); }
+
+    /* Invoke the callbacks of the recorded events in the calling thread */
+    void dispatch();
+
+    /* Deliver the events to a queue instead of recording them for dispatch(),
+     * the function is called from the background thread.
+     */
+    inline void setEventPost(OnNetworkEventPost post) { _post = post; }
+
+    /* Thread safe variants of the ConnectionHandler functions changing its state */
+    void connect();
+    void disconnect();
+    bool updateSetting(const models::NetworkSetting& s);
+
+    bool isBackgroundThread();
+
+  private:
+
+    void run();
+    void post(NetworkConnectionState const state);
+    void lock();
+    bool tryLock();
+    void unlock();
+    void wait(unsigned long const ms);
+    void wake();
+
+    ConnectionHandler & _handler;
+    std::atomic<bool> _running;
+    std::atomic<bool> _finished;
+    std::atomic<NetworkConnectionState> _state;
+    OnNetworkEventPost _post;
+
+    /* Single producer (background thread), single consumer (dispatch) event queue */
+    NetworkConnectionEvent _events[CONNECTION_HANDLER_THREAD_EVENT_QUEUE_SIZE];
+    std::atomic<uint8_t> _events_head;
+    std::atomic<uint8_t> _events_tail;
+
+#if defined(ARDUINO_ARCH_MBED)
+    rtos::Thread * _thread;
+    rtos::Mutex _mutex;
+#elif defined(ARDUINO_ARCH_ESP32)
+    static void task(void * arg);
+    TaskHandle_t _task;
+    SemaphoreHandle_t _mutex;
+#else
+    std::thread _thread;
+    std::mutex _mutex;
+    std::mutex _wait_mutex;
+    std::condition_variable _wait_cond;
+    bool _wake;
+#endif
+
+    friend ConnectionHandler;
+};
+
+#endif /* BOARD_HAS_RTOS */
+
+#endif /* ARDUINO_CONNECTION_HANDLER_THREAD_H_ */
@@ -0,0 +1,141 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerTrace.h"
+
+/******************************************************************************
+  LOCAL MODULE FUNCTIONS
+ ******************************************************************************/
+
+/* The dump is little-endian whatever the architecture */
+static size_t write_le(Print & out, uint32_t const value, size_t const len)
+{
+  uint8_t buf[4];
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+  return out.write(buf, len);
+}
+
+/******************************************************************************
+  CTOR/DTOR
+ ******************************************************************************/
+
+TraceLog::TraceLog()
+: _head{0}
+, _count{0}
+{
+
+}
+
+/******************************************************************************
+  PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+
+TraceLog & TraceLog::instance()
+{
+  static TraceLog log;
+  return log;
+}
+
+size_t TraceLog::size() const
+{
+  ConnectionHandlerLock lock(_mutex);
+  return used();
+}
+
+uint32_t TraceLog::count() const
+{
+  ConnectionHandlerLock lock(_mutex);
+  return _count;
+}
+
+size_t TraceLog::read(TraceRecord * records, size_t const max) const
+{
+  ConnectionHandlerLock lock(_mutex);
+  return copy(records, max);
+}
+
+size_t TraceLog::dump(Print & out) const
+{
+  /* Printing can be slow, the records are copied so that the handlers don't wait */
+#if CONNECTION_HANDLER_TRACE_SIZE > 0
+  TraceRecord records[CONNECTION_HANDLER_TRACE_SIZE];
+#endif
+  size_t n = 0;
+  uint32_t total = 0;
+  {
+    ConnectionHandlerLock lock(_mutex);
+#if CONNECTION_HANDLER_TRACE_SIZE > 0
+    n = copy(records, CONNECTION_HANDLER_TRACE_SIZE);
+#endif
+    total = _count;
+  }
+
+  /* Header: magic, version, record size, number of records, records written */
+  size_t written = 0;
+  written += write_le(out, CONNECTION_HANDLER_TRACE_MAGIC, 4);
+  written += write_le(out, CONNECTION_HANDLER_TRACE_VERSION, 1);
+  written += write_le(out, sizeof(TraceRecord), 1);
+  written += write_le(out, n, 2);
+  written += write_le(out, total, 4);
+
+#if CONNECTION_HANDLER_TRACE_SIZE > 0
+  for (size_t i = 0; i < n; i++) {
+    TraceRecord const & r = records[i];
+    written += write_le(out, r.timestamp, 4);
+    written += write_le(out, r.adapter, 1);
+    written += write_le(out, r.state, 1);
+    written += write_le(out, r.event, 1);
+    written += write_le(out, r.reserved, 1);
+    written += write_le(out, static_cast<uint32_t>(r.arg), 4);
+  }
+#endif
+  return written;
+}
+
+void TraceLog::clear()
+{
+  ConnectionHandlerLock lock(_mutex);
+  _head = 0;
+  _count = 0;
+}
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+size_t TraceLog::used() const
+{
+#if CONNECTION_HANDLER_TRACE_SIZE > 0
+  return _count < CONNECTION_HANDLER_TRACE_SIZE ? _count : CONNECTION_HANDLER_TRACE_SIZE;
+#else
+  return 0;
+#endif
+}
+
+size_t TraceLog::copy(TraceRecord * records, size_t const max) const
+{
+  size_t const n = used() < max ? used() : max;
+#if CONNECTION_HANDLER_TRACE_SIZE > 0
+  size_t const first = (_head + CONNECTION_HANDLER_TRACE_SIZE - used()) % CONNECTION_HANDLER_TRACE_SIZE;
+
+  for (size_t i = 0; i < n; i++) {
+    records[i] = _records[(first + i) % CONNECTION_HANDLER_TRACE_SIZE];
+  }
+#else
+  (void)records;
+#endif
+  return n;
+}
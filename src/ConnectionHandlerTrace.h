@@ -0,0 +1,124 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#pragma once
+
+/******************************************************************************
+  INCLUDES
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "ConnectionHandlerDefinitions.h"
+#include "ConnectionHandlerMutex.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+/* Number of records kept, 0 disables the trace */
+#ifndef CONNECTION_HANDLER_TRACE_SIZE
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_TRACE_SIZE 0
+  #else
+    #define CONNECTION_HANDLER_TRACE_SIZE 32
+  #endif
+#endif
+
+/* Format of the binary dump, see extras/trace_decoder.py */
+#define CONNECTION_HANDLER_TRACE_MAGIC   0x52544843UL /* "CHTR" */
+#define CONNECTION_HANDLER_TRACE_VERSION 1
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+/* The values are part of the dump format, only append new ones */
+enum class TraceEvent : uint8_t {
+  TRANSITION = 0, /* arg: next NetworkConnectionState */
+  CONNECT    = 1, /* connect() called */
+  DISCONNECT = 2, /* disconnect() called */
+  BEGIN      = 3, /* driver bring-up call, arg: its result */
+  STATUS     = 4, /* driver status polled, arg: status code */
+  PING       = 5, /* internet availability check, arg: ping result */
+  ATTACH     = 6, /* data connection attach, arg: its result */
+  JOIN       = 7, /* LoRaWAN join, arg: its result */
+  END        = 8, /* driver shutdown call */
+  FAILURE    = 9, /* driver failure, arg: error code */
+  SCAN       = 10, /* network scan, arg: networks found */
+};
+
+struct TraceRecord {
+  uint32_t timestamp; /* millis() */
+  uint8_t  adapter;   /* NetworkAdapter */
+  uint8_t  state;     /* NetworkConnectionState */
+  uint8_t  event;     /* TraceEvent */
+  uint8_t  reserved;
+  int32_t  arg;
+};
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** TraceLog class
+ * A RAM ring buffer of fixed-size binary records shared by all the connection
+ * handlers, much cheaper than formatting DEBUG_* messages: recording an event
+ * costs a few stores. The oldest records are overwritten when the ring is full.
+ * dump() writes the records to any Print, e.g. Serial or a file, as a binary
+ * stream decoded on the host by extras/trace_decoder.py. On the boards with
+ * threads the ring is guarded by a mutex, dump() prints a copy of the records.
+ */
+class TraceLog
+{
+  public:
+
+    static TraceLog & instance();
+
+#if CONNECTION_HANDLER_TRACE_SIZE > 0
+    inline void record(NetworkAdapter const adapter, NetworkConnectionState const state, TraceEvent const event, int32_t const arg) {
+      ConnectionHandlerLock lock(_mutex);
+      TraceRecord & r = _records[_head];
+      r.timestamp = millis();
+      r.adapter   = static_cast<uint8_t>(adapter);
+      r.state     = static_cast<uint8_t>(state);
+      r.event     = static_cast<uint8_t>(event);
+      r.reserved  = 0;
+      r.arg       = arg;
+      _head = (_head + 1) % CONNECTION_HANDLER_TRACE_SIZE;
+      _count++;
+    }
+#else
+    inline void record(NetworkAdapter const, NetworkConnectionState const, TraceEvent const, int32_t const) { }
+#endif
+
+    /* Copy up to max records, oldest first, returns the number of records copied */
+    size_t read(TraceRecord * records, size_t const max) const;
+    size_t dump(Print & out) const;
+    void clear();
+
+    size_t size() const;
+    /* Records written since the last clear(), including the overwritten ones */
+    uint32_t count() const;
+
+  private:
+
+    TraceLog();
+
+    size_t used() const;
+    size_t copy(TraceRecord * records, size_t const max) const;
+
+    mutable ConnectionHandlerMutex _mutex;
+
+#if CONNECTION_HANDLER_TRACE_SIZE > 0
+    TraceRecord _records[CONNECTION_HANDLER_TRACE_SIZE];
+#endif
+    size_t _head;
+    uint32_t _count;
+};
@@ -16,6 +16,7 @@
 
 #ifdef BOARD_HAS_ETHERNET /* Only compile if the board has ethernet */
 #include "EthernetConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
   CTOR/DTOR
@@ -38,6 +39,8 @@ EthernetConnectionHandler::EthernetConnectionHandler(
 : ConnectionHandler{keep_alive, NetworkAdapter::ETHERNET}
 {
   _settings.type = NetworkAdapter::ETHERNET;
+  _client_pool = &_eth_client_pool;
+  _udp_pool = &_eth_udp_pool;
   memset(_settings.eth.ip.dword, 0, sizeof(_settings.eth.ip.dword));
   memset(_settings.eth.dns.dword, 0, sizeof(_settings.eth.dns.dword));
   memset(_settings.eth.gateway.dword, 0, sizeof(_settings.eth.gateway.dword));
@@ -52,6 +55,8 @@ EthernetConnectionHandler::EthernetConnectionHandler(
 : ConnectionHandler{keep_alive, NetworkAdapter::ETHERNET}
 {
   _settings.type = NetworkAdapter::ETHERNET;
+  _client_pool = &_eth_client_pool;
+  _udp_pool = &_eth_udp_pool;
   fromIPAddress(ip, _settings.eth.ip);
   fromIPAddress(dns, _settings.eth.dns);
   fromIPAddress(gateway, _settings.eth.gateway);
@@ -68,23 +73,23 @@ int EthernetConnectionHandler::ping(IPAddress ip, uint8_t ttl, uint8_t count) {
 #if defined(ARDUINO_ARCH_ZEPHYR)
   return 0;
 #else
-  return Ethernet.ping(ip);
+  return Ethernet.ping(ip, ttl);
 #endif // ARDUINO_ARCH_ZEPHYR
 }
 
 int EthernetConnectionHandler::ping(const String &hostname, uint8_t ttl, uint8_t count) {
-#if defined(ARDUINO_ARCH_ZEPHYR)
-  return 0;
-#else
-  return Ethernet.ping(hostname);
-#endif // ARDUINO_ARCH_ZEPHYR
+  return ping(hostname.c_str(), ttl, count);
 }
 
 int EthernetConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count) {
 #if defined(ARDUINO_ARCH_ZEPHYR)
   return 0;
 #else
-  return Ethernet.ping(host);
+  IPAddress ip;
+  if (resolve(host, ip) == 1) {
+    return Ethernet.ping(ip, ttl);
+  }
+  return Ethernet.ping(host, ttl);
 #endif // ARDUINO_ARCH_ZEPHYR
 }
 
@@ -93,9 +98,64 @@ int EthernetConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count
   PROTECTED MEMBER FUNCTIONS
  ******************************************************************************/
 
+bool EthernetConnectionHandler::requiresReconnect(const models::NetworkSetting& s)
+{
+  /* The timeouts are only used by Ethernet.begin(), they don't affect the current link */
+  return memcmp(&_settings.eth.ip, &s.eth.ip, sizeof(s.eth.ip)) != 0 ||
+         memcmp(&_settings.eth.dns, &s.eth.dns, sizeof(s.eth.dns)) != 0 ||
+         memcmp(&_settings.eth.gateway, &s.eth.gateway, sizeof(s.eth.gateway)) != 0 ||
+         memcmp(&_settings.eth.netmask, &s.eth.netmask, sizeof(s.eth.netmask)) != 0;
+}
+
+int EthernetConnectionHandler::icmpRTT(IPAddress const & ip)
+{
+#if defined(ARDUINO_ARCH_ZEPHYR)
+  (void)ip;
+  return -1;
+#else
+  return Ethernet.ping(ip);
+#endif // ARDUINO_ARCH_ZEPHYR
+}
+
+int EthernetConnectionHandler::linkQuality()
+{
+  int const link = Ethernet.linkStatus();
+  return link == LinkON ? 100 : (link == LinkOFF ? 0 : -1);
+}
+
+#if defined(ARDUINO_ARCH_MBED)
+int EthernetConnectionHandler::connectTimeout(Client & client, IPAddress const & ip, uint16_t const port, unsigned long const timeout)
+{
+  /* The timeout is a setting of the client with no getter: only the pooled
+   * clients are bounded, getClient() keeps the timeout of the application.
+   */
+  EthernetClient * eth_client = _eth_client_pool.find(&client);
+  if (eth_client != nullptr) {
+    eth_client->setConnectionTimeout(timeout);
+  }
+  return client.connect(ip, port);
+}
+#endif
+
+int EthernetConnectionHandler::hostByName(const char * host, IPAddress & ip, IPFamily const family)
+{
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  if (family == IPFamily::IPV6) {
+    return mbed_host_by_name(Ethernet.getNetwork(), host, ip, family);
+  }
+  return Ethernet.hostByName(host, ip) == 1 ? 1 : 0;
+#else
+  (void)host;
+  (void)ip;
+  (void)family;
+  return 0;
+#endif
+}
+
 NetworkConnectionState EthernetConnectionHandler::update_handleInit()
 {
   if (Ethernet.hardwareStatus() == EthernetNoHardware) {
+    trace(TraceEvent::FAILURE, EthernetNoHardware);
     DEBUG_ERROR(F("Error, ethernet shield was not found."));
     return NetworkConnectionState::ERROR;
   }
@@ -110,6 +170,7 @@ NetworkConnectionState EthernetConnectionHandler::update_handleInit()
         _settings.eth.timeout,
         _settings.eth.response_timeout) == 0) {
 
+      trace(TraceEvent::BEGIN, 0);
       DEBUG_ERROR(F("Failed to configure Ethernet, check cable connection"));
       DEBUG_VERBOSE("timeout: %d, response timeout: %d",
         _settings.eth.timeout, _settings.eth.response_timeout);
@@ -118,6 +179,7 @@ NetworkConnectionState EthernetConnectionHandler::update_handleInit()
   // An ip address is not provided -> dhcp configuration
   } else {
     if (Ethernet.begin(nullptr, _settings.eth.timeout, _settings.eth.response_timeout) == 0) {
+      trace(TraceEvent::BEGIN, 0);
       DEBUG_ERROR(F("Waiting Ethernet configuration from DHCP server, check cable connection"));
       DEBUG_VERBOSE("timeout: %d, response timeout: %d",
         _settings.eth.timeout, _settings.eth.response_timeout);
@@ -126,6 +188,7 @@ NetworkConnectionState EthernetConnectionHandler::update_handleInit()
     }
   }
 
+  trace(TraceEvent::BEGIN, 1);
   return NetworkConnectionState::CONNECTING;
 }
 
@@ -140,6 +203,7 @@ NetworkConnectionState EthernetConnectionHandler::update_handleConnecting()
   }
 
   int ping_result = ping("time.arduino.cc");
+  trace(TraceEvent::PING, ping_result);
   DEBUG_INFO(F("Ethernet.ping(): %d"), ping_result);
   if (ping_result < 0)
   {
@@ -158,6 +222,7 @@ NetworkConnectionState EthernetConnectionHandler::update_handleConnecting()
 NetworkConnectionState EthernetConnectionHandler::update_handleConnected()
 {
   if (Ethernet.linkStatus() == LinkOFF) {
+    trace(TraceEvent::STATUS, LinkOFF);
     DEBUG_ERROR(F("Ethernet link OFF, connection lost."));
     if (_keep_alive)
     {
@@ -171,6 +236,7 @@ NetworkConnectionState EthernetConnectionHandler::update_handleConnected()
 NetworkConnectionState EthernetConnectionHandler::update_handleDisconnecting()
 {
   Ethernet.disconnect();
+  trace(TraceEvent::END);
   return NetworkConnectionState::DISCONNECTED;
 }
 
@@ -67,6 +67,14 @@ class EthernetConnectionHandler : public ConnectionHandler
 
   protected:
 
+    virtual int hostByName(const char * host, IPAddress & ip, IPFamily const family) override;
+    virtual int icmpRTT(IPAddress const & ip) override;
+    virtual int linkQuality() override;
+#if defined(ARDUINO_ARCH_MBED)
+    virtual int connectTimeout(Client & client, IPAddress const & ip, uint16_t const port, unsigned long const timeout) override;
+#endif
+    virtual bool requiresReconnect(const models::NetworkSetting& s) override;
+
     virtual NetworkConnectionState update_handleInit         () override;
     virtual NetworkConnectionState update_handleConnecting   () override;
     virtual NetworkConnectionState update_handleConnected    () override;
@@ -78,6 +86,9 @@ class EthernetConnectionHandler : public ConnectionHandler
     EthernetUDP _eth_udp;
     EthernetClient _eth_client;
 
+    SocketPool<Client, EthernetClient, CONNECTION_HANDLER_CLIENT_POOL_SIZE> _eth_client_pool;
+    SocketPool<UDP, EthernetUDP, CONNECTION_HANDLER_UDP_POOL_SIZE> _eth_udp_pool;
+
 };
 
 #endif /* ARDUINO_ETHERNET_CONNECTION_HANDLER_H_ */
@@ -16,6 +16,7 @@
 
 #ifdef BOARD_HAS_GSM /* Only compile if this is a board with GSM */
 #include "GSMConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
   CONSTANTS
@@ -40,12 +41,17 @@ __attribute__((weak)) void mkr_gsm_feed_watchdog()
   CTOR/DTOR
  ******************************************************************************/
 GSMConnectionHandler::GSMConnectionHandler()
-: ConnectionHandler(true, NetworkAdapter::GSM) {}
+: ConnectionHandler(true, NetworkAdapter::GSM) {
+  _client_pool = &_gsm_client_pool;
+  _udp_pool = &_gsm_udp_pool;
+}
 
 GSMConnectionHandler::GSMConnectionHandler(const char * pin, const char * apn, const char * login, const char * pass, bool const keep_alive)
 : ConnectionHandler{keep_alive, NetworkAdapter::GSM}
 {
   _settings.type = NetworkAdapter::GSM;
+  _client_pool = &_gsm_client_pool;
+  _udp_pool = &_gsm_udp_pool;
   // To keep the backward compatibility, the user can call enableCheckInternetAvailability(false) for disabling the check
   _check_internet_availability = true;
   strncpy(_settings.gsm.pin, pin, sizeof(_settings.gsm.pin)-1);
@@ -64,49 +70,105 @@ unsigned long GSMConnectionHandler::getTime()
 }
 
 int GSMConnectionHandler::ping(IPAddress ip, uint8_t ttl, uint8_t count) {
-  return _gprs.ping(ip);
+  return _gprs.ping(ip, ttl);
 }
 
 int GSMConnectionHandler::ping(const String &hostname, uint8_t ttl, uint8_t count) {
-  return _gprs.ping(hostname);
+  return _gprs.ping(hostname, ttl);
 }
 
 int GSMConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count) {
-  return _gprs.ping(host);
+  return _gprs.ping(host, ttl);
 }
 
 /******************************************************************************
   PROTECTED MEMBER FUNCTIONS
  ******************************************************************************/
 
+int GSMConnectionHandler::icmpRTT(IPAddress const & ip)
+{
+  return _gprs.ping(ip);
+}
+
+int GSMConnectionHandler::hostByName(const char * host, IPAddress & ip, IPFamily const family)
+{
+  /* The SARA-U201 only supports IPv4 data connections */
+  if (family == IPFamily::IPV6) {
+    return 0;
+  }
+  return _gprs.hostByName(host, ip) == 1 ? 1 : 0;
+}
+
 NetworkConnectionState GSMConnectionHandler::update_handleInit()
 {
   mkr_gsm_feed_watchdog();
 
-  if (_gsm.begin(_settings.gsm.pin) != GSM_READY)
+  if (step() == 0)
   {
-    DEBUG_ERROR(F("SIM not present or wrong PIN"));
-    return NetworkConnectionState::ERROR;
+    /* Start the modem without waiting for SIM unlock and network registration,
+     * their completion is polled on the next check() calls.
+     */
+    _profiles.apply(_settings.gsm);
+    trace(TraceEvent::BEGIN, static_cast<int32_t>(_gsm.begin(_settings.gsm.pin, true, false)));
+    nextStep();
+    return NetworkConnectionState::INIT;
   }
 
-  mkr_gsm_feed_watchdog();
-
-  DEBUG_INFO(F("SIM card ok"));
-  _gsm.setTimeout(GSM_TIMEOUT);
-  _gprs.setTimeout(GPRS_TIMEOUT);
+  if (step() == 1)
+  {
+    int const gsm_ready = _gsm.ready();
+    if (gsm_ready == 0 && stepElapsed() < GSM_TIMEOUT)
+    {
+      return NetworkConnectionState::INIT;
+    }
+    if (gsm_ready != 1)
+    {
+      trace(TraceEvent::FAILURE, gsm_ready);
+      if (gsm_ready == 0) {
+        DEBUG_ERROR(F("SIM unlock or network registration timed out"));
+      } else {
+        DEBUG_ERROR(F("SIM not present or wrong PIN"));
+      }
+      if (_profiles.next()) {
+        resetStep();
+        return NetworkConnectionState::INIT;
+      }
+      return NetworkConnectionState::ERROR;
+    }
+
+    DEBUG_INFO(F("SIM card ok"));
+    _gsm.setTimeout(GSM_TIMEOUT);
+    _gprs.setTimeout(GPRS_TIMEOUT);
+
+    /* Same as the modem start, the attach is polled with GPRS.ready() */
+    GSM3_NetworkStatus_t const network_status = _gprs.attachGPRS(
+      _settings.gsm.apn, _settings.gsm.login, _settings.gsm.pass, false);
+    DEBUG_DEBUG(F("GPRS.attachGPRS(): %d"), network_status);
+    (void)network_status; /* only logged */
+    nextStep();
+    return NetworkConnectionState::INIT;
+  }
 
-  mkr_gsm_feed_watchdog();
+  int const gprs_ready = _gprs.ready();
+  if (gprs_ready == 0 && stepElapsed() < GPRS_TIMEOUT)
+  {
+    return NetworkConnectionState::INIT;
+  }
 
-  GSM3_NetworkStatus_t const network_status = _gprs.attachGPRS(
-    _settings.gsm.apn, _settings.gsm.login, _settings.gsm.pass, true);
-  DEBUG_DEBUG(F("GPRS.attachGPRS(): %d"), network_status);
-  if (network_status == GSM3_NetworkStatus_t::ERROR)
+  trace(TraceEvent::ATTACH, gprs_ready);
+  DEBUG_DEBUG(F("GPRS.ready(): %d"), gprs_ready);
+  if (gprs_ready != 1)
   {
     DEBUG_ERROR(F("GPRS attach failed"));
+    if (_profiles.next()) {
+      resetStep();
+      return NetworkConnectionState::INIT;
+    }
     DEBUG_ERROR(F("Make sure the antenna is connected and reset your board."));
     return NetworkConnectionState::ERROR;
   }
 
+  _profiles.connected();
   return NetworkConnectionState::CONNECTING;
 }
 
@@ -118,6 +180,7 @@ NetworkConnectionState GSMConnectionHandler::update_handleConnecting()
 
   DEBUG_INFO(F("Sending PING to outer space..."));
   int const ping_result = ping("time.arduino.cc");
+  trace(TraceEvent::PING, ping_result);
   DEBUG_INFO(F("GPRS.ping(): %d"), ping_result);
   if (ping_result < 0)
   {
@@ -137,6 +200,7 @@ NetworkConnectionState GSMConnectionHandler::update_handleConnected()
   int const is_gsm_access_alive = _gsm.isAccessAlive();
   if (is_gsm_access_alive != 1)
   {
+    trace(TraceEvent::STATUS, is_gsm_access_alive);
     return NetworkConnectionState::DISCONNECTED;
   }
   return NetworkConnectionState::CONNECTED;
@@ -145,6 +209,7 @@ NetworkConnectionState GSMConnectionHandler::update_handleConnected()
 NetworkConnectionState GSMConnectionHandler::update_handleDisconnecting()
 {
   _gsm.shutdown();
+  trace(TraceEvent::END);
   return NetworkConnectionState::DISCONNECTED;
 }
 
@@ -16,6 +16,7 @@
  ******************************************************************************/
 
 #include "ConnectionHandlerInterface.h"
+#include "ConnectionHandlerCellularProfiles.h"
 
 #if defined(ARDUINO_SAMD_MKRGSM1400)
   #include <MKRGSM.h>
@@ -43,8 +44,14 @@ class GSMConnectionHandler : public ConnectionHandler
     virtual Client & getClient() override { return _gsm_client; };
     virtual UDP & getUDP() override { return _gsm_udp; };
 
+    /* Fallback PIN/APN/SIM profiles, used in place of the settings when any is added */
+    inline CellularProfileList & getProfiles() { return _profiles; }
+
   protected:
 
+    virtual int hostByName(const char * host, IPAddress & ip, IPFamily const family) override;
+    virtual int icmpRTT(IPAddress const & ip) override;
+
     virtual NetworkConnectionState update_handleInit         () override;
     virtual NetworkConnectionState update_handleConnecting   () override;
     virtual NetworkConnectionState update_handleConnected    () override;
@@ -54,10 +61,15 @@ class GSMConnectionHandler : public ConnectionHandler
 
   private:
 
+    CellularProfileList _profiles;
+
     GSM _gsm;
     GPRS _gprs;
     GSMUDP _gsm_udp;
     GSMClient _gsm_client;
+
+    SocketPool<Client, GSMClient, CONNECTION_HANDLER_CLIENT_POOL_SIZE> _gsm_client_pool;
+    SocketPool<UDP, GSMUDP, CONNECTION_HANDLER_UDP_POOL_SIZE> _gsm_udp_pool;
 };
 
 #endif /* #ifndef GSM_CONNECTION_MANAGER_H_ */
@@ -14,6 +14,7 @@
 
 #include "GenericConnectionHandler.h"
 #include "Arduino_ConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
   LOCAL MODULE FUNCTIONS
@@ -68,8 +69,15 @@ static inline ConnectionHandler* instantiate_handler(NetworkAdapter adapter) {
  ******************************************************************************/
 
 bool GenericConnectionHandler::updateSetting(const models::NetworkSetting& s) {
-    if(_ch != nullptr && _ch->_current_net_connection_state != NetworkConnectionState::INIT) {
-        // If the internal connection handler is already being used and not in INIT phase we cannot update the settings
+    if(isRacing()) {
+        endRace(_racers_count);
+    }
+
+    if(_ch != nullptr && _ch->_current_net_connection_state != NetworkConnectionState::INIT && _interface == s.type) {
+        // The internal connection handler stages the settings until its next reconnection
+        return _ch->updateSetting(s);
+    } else if(_ch != nullptr && _ch->_current_net_connection_state != NetworkConnectionState::INIT) {
+        // If the internal connection handler is already being used and not in INIT phase we cannot change the interface
         return false;
     } else if(_ch != nullptr && _ch->_current_net_connection_state == NetworkConnectionState::INIT && _interface != s.type) {
         // If the internal connection handler is already being used and in INIT phase and the interface type is being changed
@@ -96,6 +104,64 @@ bool GenericConnectionHandler::updateSetting(const models::NetworkSetting& s) {
     }
 }
 
+bool GenericConnectionHandler::race(const models::NetworkSetting * settings, size_t const count) {
+    if(isRacing() || count > CONNECTION_HANDLER_RACE_MAX_HANDLERS) {
+        return false;
+    }
+
+    // Two handlers of the same type would drive the same interface
+    for(size_t i = 0; i < count; i++) {
+        for(size_t j = 0; j < i; j++) {
+            if(settings[i].type == settings[j].type) {
+                return false;
+            }
+        }
+    }
+
+#if defined(BOARD_HAS_RTOS)
+    // The losers of the previous race may still be in a driver call
+    reapLosers();
+    if(_losers_count > 0) {
+        return false;
+    }
+#endif
+
+    if(_ch != nullptr) {
+        // Same as updateSetting(), the handler in use can be replaced only in INIT phase
+        if(_ch->_current_net_connection_state != NetworkConnectionState::INIT) {
+            return false;
+        }
+        delete _ch;
+        _ch = nullptr;
+    }
+
+    _interface = NetworkAdapter::NONE;
+    _race_winner = NetworkAdapter::NONE;
+    _race_time = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        ConnectionHandler* ch = instantiate_handler(settings[i].type);
+        if(ch == nullptr) {
+            continue;
+        }
+
+        ch->setKeepAlive(true);
+        ch->enableCheckInternetAvailability(_check_internet_availability);
+        ch->updateSetting(settings[i]);
+        _racers[_racers_count] = ch;
+
+#if defined(BOARD_HAS_RTOS)
+        // If the thread cannot be started the handler is checked from updateRace()
+        _racer_threads[_racers_count] = new ConnectionHandlerThread(*ch);
+        _racer_threads[_racers_count]->begin();
+#endif
+        _racers_count++;
+    }
+
+    _race_start = millis();
+    return isRacing();
+}
+
 void GenericConnectionHandler::getSetting(models::NetworkSetting& s) {
     if(_ch != nullptr) {
         _ch->getSetting(s);
@@ -104,6 +170,16 @@ void GenericConnectionHandler::getSetting(models::NetworkSetting& s) {
     }
 }
 
+void GenericConnectionHandler::applySettings() {
+    if(_ch != nullptr) {
+        _ch->applySettings();
+    }
+}
+
+bool GenericConnectionHandler::hasPendingSetting() {
+    return _ch != nullptr ? _ch->hasPendingSetting() : false;
+}
+
 #if !defined(BOARD_HAS_LORA)
 unsigned long GenericConnectionHandler::getTime() {
     return _ch != nullptr ? _ch->getTime() : 0;
@@ -121,6 +197,29 @@ int GenericConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count)
     return _ch != nullptr ? _ch->ping(host, ttl, count) : 0;
 }
 
+int GenericConnectionHandler::resolve(const char * host, IPAddress & ip, IPFamily const family) {
+    return _ch != nullptr ? _ch->resolve(host, ip, family) : 0;
+}
+
+int GenericConnectionHandler::connectClient(Client & client, const char * host, uint16_t const port) {
+    return _ch != nullptr ? _ch->connectClient(client, host, port) : 0;
+}
+
+RTTStats GenericConnectionHandler::measureRTT(const char * host, uint8_t const count, uint16_t const port) {
+    if(_ch != nullptr) {
+        _rtt_stats = _ch->measureRTT(host, count, port);
+    }
+    return _rtt_stats;
+}
+
+ConnectionQuality GenericConnectionHandler::getQuality() {
+    return _ch != nullptr ? _ch->getQuality() : ConnectionHandler::getQuality();
+}
+
+NetworkAdapter GenericConnectionHandler::getRoutedAdapter() {
+    return _ch != nullptr ? _ch->getRoutedAdapter() : ConnectionHandler::getRoutedAdapter();
+}
+
 Client & GenericConnectionHandler::getClient() {
     return _ch->getClient(); // NOTE _ch may be nullptr
 }
@@ -129,6 +228,30 @@ UDP & GenericConnectionHandler::getUDP() {
     return _ch->getUDP(); // NOTE _ch may be nullptr
 }
 
+Client * GenericConnectionHandler::acquireClient() {
+    return _ch != nullptr ? _ch->acquireClient() : nullptr;
+}
+
+bool GenericConnectionHandler::releaseClient(Client * client) {
+    return _ch != nullptr ? _ch->releaseClient(client) : false;
+}
+
+UDP * GenericConnectionHandler::acquireUDP() {
+    return _ch != nullptr ? _ch->acquireUDP() : nullptr;
+}
+
+bool GenericConnectionHandler::releaseUDP(UDP * udp) {
+    return _ch != nullptr ? _ch->releaseUDP(udp) : false;
+}
+
+SocketPoolStats GenericConnectionHandler::getClientPoolStats() {
+    return _ch != nullptr ? _ch->getClientPoolStats() : ConnectionHandler::getClientPoolStats();
+}
+
+SocketPoolStats GenericConnectionHandler::getUDPPoolStats() {
+    return _ch != nullptr ? _ch->getUDPPoolStats() : ConnectionHandler::getUDPPoolStats();
+}
+
 #endif // !defined(BOARD_HAS_LORA)
 
 void GenericConnectionHandler::connect() {
@@ -139,6 +262,9 @@ void GenericConnectionHandler::connect() {
 }
 
 void GenericConnectionHandler::disconnect() {
+    if(isRacing()) {
+        endRace(_racers_count);
+    }
     if(_ch!=nullptr) {
         _ch->disconnect();
     }
@@ -158,6 +284,18 @@ void GenericConnectionHandler::setKeepAlive(bool keep_alive) {
  ******************************************************************************/
 
 NetworkConnectionState GenericConnectionHandler::updateConnectionState() {
+#if defined(BOARD_HAS_RTOS)
+    if(_losers_count > 0) {
+        reapLosers();
+    }
+#endif
+    if(isRacing()) {
+        return updateRace();
+    }
+    // A race without winner stays in ERROR until the next race()
+    if(_ch == nullptr && _current_net_connection_state == NetworkConnectionState::ERROR) {
+        return NetworkConnectionState::ERROR;
+    }
     return _ch != nullptr ? _ch->updateConnectionState() : NetworkConnectionState::INIT;
 }
 
@@ -180,3 +318,92 @@ NetworkConnectionState GenericConnectionHandler::update_handleDisconnecting() {
 NetworkConnectionState GenericConnectionHandler::update_handleDisconnected() {
     return _ch != nullptr ? _ch->update_handleDisconnected() : NetworkConnectionState::INIT;
 }
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+NetworkConnectionState GenericConnectionHandler::updateRace() {
+    bool failed = true;
+
+    for(size_t i = 0; i < _racers_count; i++) {
+        // With a running thread check() only returns the state published by the thread
+        NetworkConnectionState const state = _racers[i]->check();
+
+        if(state == NetworkConnectionState::CONNECTED) {
+            _race_time = millis() - _race_start;
+            endRace(i);
+            return NetworkConnectionState::CONNECTED;
+        }
+        failed = failed && (state == NetworkConnectionState::ERROR);
+    }
+
+    if(failed) {
+        // No winner is left: the racers are stopped and reaped as losers
+        DEBUG_ERROR(F("No network adapter connected"));
+        endRace(_racers_count);
+        return NetworkConnectionState::ERROR;
+    }
+    return NetworkConnectionState::INIT;
+}
+
+void GenericConnectionHandler::endRace(size_t const winner) {
+    for(size_t i = 0; i < _racers_count; i++) {
+#if defined(BOARD_HAS_RTOS)
+        if(i == winner) {
+            // The winner published CONNECTED and is waiting for its next tick
+            delete _racer_threads[i];
+            continue;
+        }
+
+        // A loser may be blocked in a driver call, e.g. a DHCP request: it is
+        // not waited for here but reaped once its thread has left
+        _racer_threads[i]->stop();
+        _losers[_losers_count] = _racers[i];
+        _loser_threads[_losers_count] = _racer_threads[i];
+        _losers_count++;
+#else
+        if(i != winner) {
+            tearDown(_racers[i]);
+        }
+#endif
+    }
+
+    if(winner < _racers_count) {
+        _ch = _racers[winner];
+        _ch->setKeepAlive(_keep_alive);
+        _interface = _ch->getInterface();
+        _race_winner = _interface;
+        DEBUG_INFO(F("Network adapter %d connected first, after %lu ms"), _race_winner, _race_time);
+    }
+
+    _racers_count = 0;
+}
+
+void GenericConnectionHandler::tearDown(ConnectionHandler * ch) {
+    // The losers are torn down right away, without waiting for their TimeoutTable
+    ch->setKeepAlive(false);
+    ch->update_handleDisconnecting();
+    ch->update_handleDisconnected();
+    delete ch;
+}
+
+#if defined(BOARD_HAS_RTOS)
+void GenericConnectionHandler::reapLosers() {
+    size_t count = 0;
+
+    for(size_t i = 0; i < _losers_count; i++) {
+        if(!_loser_threads[i]->finished()) {
+            _losers[count] = _losers[i];
+            _loser_threads[count] = _loser_threads[i];
+            count++;
+            continue;
+        }
+
+        delete _loser_threads[i];
+        tearDown(_losers[i]);
+    }
+
+    _losers_count = count;
+}
+#endif
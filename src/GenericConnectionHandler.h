@@ -17,6 +17,14 @@
 
 #include "ConnectionHandlerInterface.h"
 
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#ifndef CONNECTION_HANDLER_RACE_MAX_HANDLERS
+  #define CONNECTION_HANDLER_RACE_MAX_HANDLERS 2
+#endif
+
 /******************************************************************************
   CLASS DECLARATION
  ******************************************************************************/
@@ -29,7 +37,13 @@ class GenericConnectionHandler : public ConnectionHandler
 {
   public:
 
-    GenericConnectionHandler(bool const keep_alive=true): ConnectionHandler(keep_alive), _ch(nullptr) {}
+    GenericConnectionHandler(bool const keep_alive=true)
+    : ConnectionHandler(keep_alive), _ch(nullptr)
+#if defined(BOARD_HAS_RTOS)
+    , _losers_count(0)
+#endif
+    , _racers_count(0), _race_time(0), _race_winner(NetworkAdapter::NONE)
+    {}
 
     #if defined(BOARD_HAS_LORA)
       virtual bool available() = 0;
@@ -40,6 +54,12 @@ class GenericConnectionHandler : public ConnectionHandler
       int ping(const String &hostname, uint8_t ttl = 128, uint8_t count = 1) override;
       int ping(const char* host, uint8_t ttl = 128, uint8_t count = 1) override;
 
+      int resolve(const char * host, IPAddress & ip, IPFamily const family = IPFamily::IPV4) override;
+      int connectClient(Client & client, const char * host, uint16_t const port) override;
+      RTTStats measureRTT(const char * host, uint8_t const count = 4, uint16_t const port = 443) override;
+      ConnectionQuality getQuality() override;
+      NetworkAdapter getRoutedAdapter() override;
+
       unsigned long getTime() override;
 
       /*
@@ -50,10 +70,33 @@ class GenericConnectionHandler : public ConnectionHandler
        */
       Client & getClient() override;
       UDP & getUDP() override;
+
+      Client * acquireClient() override;
+      bool releaseClient(Client * client) override;
+      UDP * acquireUDP() override;
+      bool releaseUDP(UDP * udp) override;
+
+      SocketPoolStats getClientPoolStats() override;
+      SocketPoolStats getUDPPoolStats() override;
     #endif
 
     bool updateSetting(const models::NetworkSetting& s) override;
     void getSetting(models::NetworkSetting& s) override;
+    void applySettings() override;
+    bool hasPendingSetting() override;
+
+    /* Racing mode: a handler is brought up for each one of the given settings at the
+     * same time, the first one reaching CONNECTED is adopted as if it was configured
+     * with updateSetting() and the others are torn down. On platforms with threads
+     * every handler runs in its own ConnectionHandlerThread during the race,
+     * otherwise their state machines are interleaved. The threads of the losers
+     * are left to complete a driver call in progress and reaped by a later
+     * check(), a new race can't start before. Each adapter can race only once.
+     */
+    bool race(const models::NetworkSetting * settings, size_t const count);
+    inline bool isRacing() const { return _racers_count > 0; }
+    inline NetworkAdapter getRaceWinner() const { return _race_winner; }
+    inline unsigned long getRaceTime() const { return _race_time; }
 
     void connect() override;
     void disconnect() override;
@@ -72,7 +115,26 @@ class GenericConnectionHandler : public ConnectionHandler
 
   private:
 
+    NetworkConnectionState updateRace();
+    void endRace(size_t const winner);
+    void tearDown(ConnectionHandler * ch);
+#if defined(BOARD_HAS_RTOS)
+    void reapLosers();
+#endif
+
     ConnectionHandler* _ch;
+
+    ConnectionHandler* _racers[CONNECTION_HANDLER_RACE_MAX_HANDLERS];
+#if defined(BOARD_HAS_RTOS)
+    ConnectionHandlerThread* _racer_threads[CONNECTION_HANDLER_RACE_MAX_HANDLERS];
+    ConnectionHandler* _losers[CONNECTION_HANDLER_RACE_MAX_HANDLERS];
+    ConnectionHandlerThread* _loser_threads[CONNECTION_HANDLER_RACE_MAX_HANDLERS];
+    size_t _losers_count;
+#endif
+    size_t _racers_count;
+    unsigned long _race_start;
+    unsigned long _race_time;
+    NetworkAdapter _race_winner;
 };
 
 #endif /* ARDUINO_GENERIC_CONNECTION_HANDLER_H_ */
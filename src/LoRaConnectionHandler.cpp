@@ -16,23 +16,97 @@
 
 #if defined(BOARD_HAS_LORA) /* Only compile if the board has LoRa */
 #include "LoRaConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
-  TYPEDEF
+  CONSTANTS
  ******************************************************************************/
 
-typedef enum
+static unsigned long const LORA_INIT_DELAY = 100;
+
+/* MHDR, FHDR without options, FPort and MIC */
+static size_t const LORAWAN_OVERHEAD = 13;
+
+/******************************************************************************
+  LOCAL MODULE FUNCTIONS
+ ******************************************************************************/
+
+/* Regulatory duty cycle of the band, in per mille, 0 if not limited */
+static uint16_t lora_band_duty_cycle(_lora_band const band)
 {
-  LORA_ERROR_ACK_NOT_RECEIVED     = -1,
-  LORA_ERROR_GENERIC              = -2,
-  LORA_ERROR_WRONG_PARAM          = -3,
-  LORA_ERROR_COMMUNICATION_BUSY   = -4,
-  LORA_ERROR_MESSAGE_OVERFLOW     = -5,
-  LORA_ERROR_NO_NETWORK_AVAILABLE = -6,
-  LORA_ERROR_RX_PACKET            = -7,
-  LORA_ERROR_REASON_UNKNOWN       = -8,
-  LORA_ERROR_MAX_PACKET_SIZE      = -20
-} LoRaCommunicationError;
+  switch (band)
+  {
+    case _lora_band::EU868:
+    case _lora_band::EU433:
+    case _lora_band::CN779: return 10;
+    default:                return 0;
+  }
+}
+
+/* Largest application payload at the given data rate, without MAC commands. The
+ * modem reports -1 if the data rate can't be read: the smallest payload is assumed.
+ */
+static size_t lora_max_payload(_lora_band const band, int const dr)
+{
+  switch (band)
+  {
+    case _lora_band::US915:
+      static uint8_t const US915_MAX_PAYLOAD[] = { 11, 53, 125, 242, 242 };
+      if (dr < 0) return US915_MAX_PAYLOAD[0];
+      return dr <= 4 ? US915_MAX_PAYLOAD[dr] : 242;
+    default:
+      static uint8_t const MAX_PAYLOAD[] = { 51, 51, 51, 115, 222, 222, 222, 222 };
+      if (dr < 0) return MAX_PAYLOAD[0];
+      return dr <= 7 ? MAX_PAYLOAD[dr] : 51;
+  }
+}
+
+/* Time on air in us of a LoRaWAN frame with the given application payload, as in
+ * the Semtech SX1272 datasheet: explicit header, CRC on, coding rate 4/5 and
+ * 8 preamble symbols. Returns 0 for the FSK data rate, computed by the caller.
+ */
+static uint32_t lora_time_on_air(_lora_band const band, int const dr, size_t const size)
+{
+  int sf = 0, bw = 125;
+  switch (band)
+  {
+    case _lora_band::US915:
+      if (dr <= 3)      { sf = 10 - dr; }
+      else if (dr == 4) { sf = 8; bw = 500; }
+      else              { sf = 12 - (dr - 8); bw = 500; }
+      break;
+    case _lora_band::AU915:
+      if (dr <= 5)      { sf = 12 - dr; }
+      else              { sf = 8; bw = 500; }
+      break;
+    default:
+      if (dr <= 5)      { sf = 12 - dr; }
+      else if (dr == 6) { sf = 7; bw = 250; }
+      else              { return 0; }
+      break;
+  }
+
+  uint32_t const symbol = (1UL << sf) * 1000UL / static_cast<uint32_t>(bw);
+  int const de = (sf >= 11 && bw == 125) ? 1 : 0;
+  int const num = 8 * static_cast<int>(size + LORAWAN_OVERHEAD) - 4 * sf + 28 + 16;
+  int const den = 4 * (sf - 2 * de);
+  int const payload_symbols = 8 + (num > 0 ? ((num + den - 1) / den) * 5 : 0);
+
+  return (49 * symbol) / 4 + payload_symbols * symbol;
+}
+
+static uint32_t crc32(const void * data, size_t const len, uint32_t crc = 0)
+{
+  const uint8_t * bytes = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= bytes[i];
+    for (int b = 0; b < 8; b++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
 
 /******************************************************************************
   CTOR/DTOR
@@ -46,66 +120,188 @@ LoRaConnectionHandler::LoRaConnectionHandler(char const * appeui, char const * a
   _settings.lora.band = band;
   strncpy(_settings.lora.channelMask, channelMask, sizeof(_settings.lora.channelMask)-1);
   _settings.lora.deviceClass = device_class;
+  _airtime_budget = lora_band_duty_cycle(band);
 }
 
 /******************************************************************************
   PUBLIC MEMBER FUNCTIONS
  ******************************************************************************/
 
-int LoRaConnectionHandler::write(const uint8_t * buf, size_t size)
+NetworkConnectionState LoRaConnectionHandler::check()
 {
-  _modem.beginPacket();
-  _modem.write(buf, size);
-  int const err = _modem.endPacket(true);
+  NetworkConnectionState const state = ConnectionHandler::check();
 
-  if (err != size)
-  {
-    switch (err)
-    {
-      case LoRaCommunicationError::LORA_ERROR_ACK_NOT_RECEIVED:
-        DEBUG_ERROR(F("Message ack was not received, the message could not be delivered"));
-        break;
-      case LoRaCommunicationError::LORA_ERROR_GENERIC:
-        DEBUG_ERROR(F("LoRa generic error (LORA_ERROR)"));
-        break;
-      case LoRaCommunicationError::LORA_ERROR_WRONG_PARAM:
-        DEBUG_ERROR(F("LoRa malformed param error (LORA_ERROR_PARAM"));
-        break;
-      case LoRaCommunicationError::LORA_ERROR_COMMUNICATION_BUSY:
-        DEBUG_ERROR(F("LoRa chip is busy (LORA_ERROR_BUSY)"));
-        break;
-      case LoRaCommunicationError::LORA_ERROR_MESSAGE_OVERFLOW:
-        DEBUG_ERROR(F("LoRa chip overflow error (LORA_ERROR_OVERFLOW)"));
-        break;
-      case LoRaCommunicationError::LORA_ERROR_NO_NETWORK_AVAILABLE:
-        DEBUG_ERROR(F("LoRa no network error (LORA_ERROR_NO_NETWORK)"));
-        break;
-      case LoRaCommunicationError::LORA_ERROR_RX_PACKET:
-        DEBUG_ERROR(F("LoRa rx error (LORA_ERROR_RX)"));
-        break;
-      case LoRaCommunicationError::LORA_ERROR_REASON_UNKNOWN:
-        DEBUG_ERROR(F("LoRa unknown error (LORA_ERROR_UNKNOWN)"));
-        break;
-      case LoRaCommunicationError::LORA_ERROR_MAX_PACKET_SIZE:
-        DEBUG_ERROR(F("Message length is bigger than max LoRa packet!"));
-        break;
+  if (_frag_src != nullptr && state == NetworkConnectionState::CONNECTED &&
+      static_cast<long>(millis() - nextSendTime()) >= 0) {
+    sendFragment();
+  } else if (_tx_count > 0 && state == NetworkConnectionState::CONNECTED &&
+      static_cast<long>(millis() - nextSendTime()) >= 0) {
+    TxMessage const & message = _tx_queue[_tx_head];
+    int const result = transmit(message.data, message.size, message.confirmed);
+    _tx_head = (_tx_head + 1) % CONNECTION_HANDLER_LORA_TX_QUEUE_SIZE;
+    _tx_count--;
+    if (_on_sent) {
+      _on_sent(result);
     }
   }
-  else
-  {
-    DEBUG_INFO(F("Message sent correctly!"));
+
+  return state;
+}
+
+int LoRaConnectionHandler::write(const uint8_t * buf, size_t size)
+{
+  if (static_cast<long>(millis() - nextSendTime()) < 0) {
+    DEBUG_DEBUG(F("Airtime budget exhausted, next uplink in %lu ms"), nextSendTime() - millis());
+    return LoRaCommunicationError::LORA_ERROR_COMMUNICATION_BUSY;
+  }
+  return transmit(buf, size, true);
+}
+
+bool LoRaConnectionHandler::send(const uint8_t * buf, size_t const size, bool const confirmed)
+{
+  if (_tx_count >= CONNECTION_HANDLER_LORA_TX_QUEUE_SIZE || size > CONNECTION_HANDLER_LORA_MAX_PAYLOAD) {
+    return false;
+  }
+
+  /* Checked again by the modem when sent, the data rate can be lowered in the meantime */
+  if (size > maxPayload()) {
+    DEBUG_ERROR(F("Message of %d bytes too large for the data rate"), size);
+    return false;
+  }
+
+  if (static_cast<long>(millis() - nextSendTime()) < 0) {
+    _airtime_stats.deferred++;
+  }
+
+  TxMessage & message = _tx_queue[(_tx_head + _tx_count) % CONNECTION_HANDLER_LORA_TX_QUEUE_SIZE];
+  memcpy(message.data, buf, size);
+  message.size = size;
+  message.confirmed = confirmed;
+  _tx_count++;
+  return true;
+}
+
+bool LoRaConnectionHandler::sendFragmented(const uint8_t * buf, size_t const size, bool const confirmed)
+{
+  if (_frag_src != nullptr || size == 0) {
+    return false;
+  }
+
+  /* Checked again while sending, the data rate can be lowered in the meantime */
+  if (size > LORA_FRAGMENT_MAX_COUNT * fragmentRoom() || size > 0xFFFF) {
+    DEBUG_ERROR(F("Message too large for %d fragments"), LORA_FRAGMENT_MAX_COUNT);
+    return false;
+  }
+
+  _frag_src = buf;
+  _frag_size = size;
+  _frag_offset = 0;
+  _frag_index = 0;
+  _frag_attempts = 0;
+  _frag_confirmed = confirmed;
+  _frag_id = (_frag_id + 1) & 0x0F;
+  /* The far end is expected to answer with fragments too */
+  _frag_enabled = true;
+  return true;
+}
+
+int LoRaConnectionHandler::readMessage(uint8_t * buf, size_t const size)
+{
+  if (!messageAvailable()) {
+    return 0;
+  }
+
+  size_t const copied = _reasm_total < size ? _reasm_total : size;
+  memcpy(buf, _reasm_data, copied);
+  _reasm_complete = false;
+  _reasm_id = -1;
+  return copied;
+}
+
+bool LoRaConnectionHandler::messageAvailable()
+{
+  pollDownlink();
+  return _reasm_complete;
+}
+
+size_t LoRaConnectionHandler::maxPayload()
+{
+  return lora_max_payload(static_cast<_lora_band>(_settings.lora.band), _modem.getDataRate());
+}
+
+unsigned long LoRaConnectionHandler::nextSendTime() const
+{
+  return _tx_end + _tx_off_time;
+}
+
+unsigned long LoRaConnectionHandler::timeOnAir(size_t const size)
+{
+  _lora_band const band = static_cast<_lora_band>(_settings.lora.band);
+  int const dr = _modem.getDataRate();
+  uint32_t const toa = lora_time_on_air(band, dr, size);
+
+  if (toa == 0) {
+    /* FSK 50 kbps: preamble, sync word, length, payload and CRC */
+    return ((5 + 3 + 1 + size + LORAWAN_OVERHEAD + 2) * 8 * 20 + 999) / 1000;
+  }
+  return (toa + 999) / 1000;
+}
+
+void LoRaConnectionHandler::invalidateSession()
+{
+  _session_invalid = true;
+  if (_session_store) {
+    /* A zeroed session never passes the CRC check */
+    LoRaSession session;
+    memset(&session, 0, sizeof(session));
+    _session_store(session);
   }
-  return err;
 }
 
 int LoRaConnectionHandler::read()
 {
-  return _modem.read();
+  pollDownlink();
+  if (_rx_count == 0) {
+    return -1;
+  }
+
+  LoRaPacketInfo const & info = _rx_info[_rx_head];
+  size_t const length = info.length < CONNECTION_HANDLER_LORA_MAX_PAYLOAD ? info.length : CONNECTION_HANDLER_LORA_MAX_PAYLOAD;
+  int const c = _rx_data[_rx_head][_rx_offset++];
+  if (_rx_offset >= length) {
+    popPacket();
+  }
+  return c;
 }
 
 bool LoRaConnectionHandler::available()
 {
-  return _modem.available();
+  return packetsAvailable() > 0;
+}
+
+int LoRaConnectionHandler::readPacket(uint8_t * buf, size_t const size, LoRaPacketInfo * info)
+{
+  pollDownlink();
+  if (_rx_count == 0) {
+    return 0;
+  }
+
+  LoRaPacketInfo const & packet = _rx_info[_rx_head];
+  size_t const stored = packet.length < CONNECTION_HANDLER_LORA_MAX_PAYLOAD ? packet.length : CONNECTION_HANDLER_LORA_MAX_PAYLOAD;
+  size_t const copied = (stored - _rx_offset) < size ? (stored - _rx_offset) : size;
+
+  memcpy(buf, &_rx_data[_rx_head][_rx_offset], copied);
+  if (info != nullptr) {
+    *info = packet;
+  }
+  popPacket();
+  return copied;
+}
+
+size_t LoRaConnectionHandler::packetsAvailable()
+{
+  pollDownlink();
+  return _rx_count;
 }
 
 /******************************************************************************
@@ -114,26 +310,50 @@ bool LoRaConnectionHandler::available()
 
 NetworkConnectionState LoRaConnectionHandler::update_handleInit()
 {
-  if (!_modem.begin((_lora_band)_settings.lora.band))
+  switch (step())
   {
-    DEBUG_ERROR(F("Something went wrong; are you indoor? Move near a window, then reset and retry."));
-    return NetworkConnectionState::ERROR;
-  }
-  // Set channelmask based on configuration
-  if (_settings.lora.channelMask) {
-    _modem.sendMask(_settings.lora.channelMask);
+    case 0:
+      if (!_modem.begin((_lora_band)_settings.lora.band))
+      {
+        trace(TraceEvent::BEGIN, 0);
+        DEBUG_ERROR(F("Something went wrong; are you indoor? Move near a window, then reset and retry."));
+        return NetworkConnectionState::ERROR;
+      }
+      // Set channelmask based on configuration
+      if (_settings.lora.channelMask) {
+        _modem.sendMask(_settings.lora.channelMask);
+      }
+      nextStep();
+      return NetworkConnectionState::INIT;
+
+    case 1:
+      //A delay is required between _modem.begin(band) and _modem.joinOTAA(appeui, appkey) in order to let the chip to be correctly initialized before the connection attempt
+      if (stepElapsed() < LORA_INIT_DELAY) {
+        return NetworkConnectionState::INIT;
+      }
+      _modem.configureClass((_lora_class)_settings.lora.deviceClass);
+      nextStep();
+      return NetworkConnectionState::INIT;
+
+    default:
+      if (stepElapsed() < LORA_INIT_DELAY) {
+        return NetworkConnectionState::INIT;
+      }
+      DEBUG_INFO(F("Connecting to the network"));
+      return NetworkConnectionState::CONNECTING;
   }
-  //A delay is required between _modem.begin(band) and _modem.joinOTAA(appeui, appkey) in order to let the chip to be correctly initialized before the connection attempt
-  delay(100);
-  _modem.configureClass((_lora_class)_settings.lora.deviceClass);
-  delay(100);
-  DEBUG_INFO(F("Connecting to the network"));
-  return NetworkConnectionState::CONNECTING;
 }
 
 NetworkConnectionState LoRaConnectionHandler::update_handleConnecting()
 {
+  if (restoreSession())
+  {
+    DEBUG_INFO(F("Session restored, join skipped"));
+    return NetworkConnectionState::CONNECTED;
+  }
+
   bool const network_status = _modem.joinOTAA(_settings.lora.appeui, _settings.lora.appkey);
+  trace(TraceEvent::JOIN, network_status);
   if (network_status != true)
   {
     DEBUG_ERROR(F("Connection to the network failed"));
@@ -143,15 +363,27 @@ NetworkConnectionState LoRaConnectionHandler::update_handleConnecting()
   else
   {
     DEBUG_INFO(F("Connected to the network"));
+    _session_invalid = false;
+    storeSession();
     return NetworkConnectionState::CONNECTED;
   }
 }
 
 NetworkConnectionState LoRaConnectionHandler::update_handleConnected()
 {
+  pollDownlink();
+
+  if (_session_invalid)
+  {
+    DEBUG_INFO(F("Session invalidated, joining again"));
+    _session_restored = false;
+    return NetworkConnectionState::CONNECTING;
+  }
+
   bool const network_status = _modem.connected();
   if (network_status != true)
   {
+    trace(TraceEvent::STATUS, 0);
     DEBUG_ERROR(F("Connection to the network lost."));
     if (_keep_alive)
     {
@@ -184,4 +416,320 @@ NetworkConnectionState LoRaConnectionHandler::update_handleDisconnected()
   }
 }
 
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+int LoRaConnectionHandler::transmit(const uint8_t * buf, size_t const size, bool const confirmed)
+{
+  unsigned long const toa = timeOnAir(size);
+
+  _modem.beginPacket();
+  _modem.write(buf, size);
+  int const err = _modem.endPacket(confirmed);
+
+  /* The frame has been on air unless the modem refused it. Retransmissions of
+   * confirmed frames are not visible here and are not accounted for.
+   */
+  bool const on_air = err > 0 || err == LoRaCommunicationError::LORA_ERROR_ACK_NOT_RECEIVED;
+  if (on_air) {
+    _tx_end = millis();
+    _tx_off_time = _airtime_budget > 0 ? toa * (1000 - _airtime_budget) / _airtime_budget : 0;
+    _airtime_stats.airtime += toa;
+    _airtime_stats.last_time_on_air = toa;
+  }
+
+  if (err != size)
+  {
+    switch (err)
+    {
+      case LoRaCommunicationError::LORA_ERROR_ACK_NOT_RECEIVED:
+        DEBUG_ERROR(F("Message ack was not received, the message could not be delivered"));
+        break;
+      case LoRaCommunicationError::LORA_ERROR_GENERIC:
+        DEBUG_ERROR(F("LoRa generic error (LORA_ERROR)"));
+        break;
+      case LoRaCommunicationError::LORA_ERROR_WRONG_PARAM:
+        DEBUG_ERROR(F("LoRa malformed param error (LORA_ERROR_PARAM"));
+        break;
+      case LoRaCommunicationError::LORA_ERROR_COMMUNICATION_BUSY:
+        DEBUG_ERROR(F("LoRa chip is busy (LORA_ERROR_BUSY)"));
+        break;
+      case LoRaCommunicationError::LORA_ERROR_MESSAGE_OVERFLOW:
+        DEBUG_ERROR(F("LoRa chip overflow error (LORA_ERROR_OVERFLOW)"));
+        break;
+      case LoRaCommunicationError::LORA_ERROR_NO_NETWORK_AVAILABLE:
+        DEBUG_ERROR(F("LoRa no network error (LORA_ERROR_NO_NETWORK)"));
+        break;
+      case LoRaCommunicationError::LORA_ERROR_RX_PACKET:
+        DEBUG_ERROR(F("LoRa rx error (LORA_ERROR_RX)"));
+        break;
+      case LoRaCommunicationError::LORA_ERROR_REASON_UNKNOWN:
+        DEBUG_ERROR(F("LoRa unknown error (LORA_ERROR_UNKNOWN)"));
+        break;
+      case LoRaCommunicationError::LORA_ERROR_MAX_PACKET_SIZE:
+        DEBUG_ERROR(F("Message length is bigger than max LoRa packet!"));
+        break;
+    }
+  }
+  else
+  {
+    DEBUG_INFO(F("Message sent correctly!"));
+  }
+
+  /* A restored session the network server doesn't know anymore only shows as missing ACKs */
+  if (err == LoRaCommunicationError::LORA_ERROR_ACK_NOT_RECEIVED && _session_restored) {
+    if (++_session_ack_failures >= CONNECTION_HANDLER_LORA_SESSION_MAX_ACK_FAILURES) {
+      invalidateSession();
+    }
+  } else if (err > 0) {
+    _session_ack_failures = 0;
+  }
+
+  /* Wear-aware checkpoint of the frame counters, every frame on air used one */
+  if (on_air && ++_session_uplinks >= CONNECTION_HANDLER_LORA_SESSION_CHECKPOINT) {
+    storeSession();
+  }
+
+  /* A class A downlink is received in the RX windows following the uplink */
+  pollDownlink();
+  return err;
+}
+
+bool LoRaConnectionHandler::restoreSession()
+{
+  if (!_session_load || _session_invalid) {
+    return false;
+  }
+
+  LoRaSession session;
+  memset(&session, 0, sizeof(session));
+  if (!_session_load(session)) {
+    return false;
+  }
+
+  if (session.crc != crc32(&session, offsetof(LoRaSession, crc)) ||
+      session.version != CONNECTION_HANDLER_LORA_SESSION_VERSION ||
+      session.band != _settings.lora.band ||
+      session.credentials != credentials()) {
+    DEBUG_WARNING(F("Saved session not valid"));
+    return false;
+  }
+
+  /* The modem takes a 16 bits uplink counter: skipping the checkpoint interval
+   * would roll it back and the network server would drop every uplink.
+   */
+  if (session.fcu + CONNECTION_HANDLER_LORA_SESSION_CHECKPOINT > 0xFFFF) {
+    DEBUG_WARNING(F("Saved session uplink counter exhausted, joining again"));
+    invalidateSession();
+    return false;
+  }
+
+  session.devaddr[sizeof(session.devaddr)-1] = '\0';
+  session.nwkskey[sizeof(session.nwkskey)-1] = '\0';
+  session.appskey[sizeof(session.appskey)-1] = '\0';
+  if (!_modem.joinABP(session.devaddr, session.nwkskey, session.appskey)) {
+    trace(TraceEvent::JOIN, 0);
+    return false;
+  }
+
+  /* Up to a checkpoint interval of uplinks may have been sent after the last save:
+   * skip them, a reused uplink counter would be rejected by the network server.
+   */
+  _modem.setFCU(session.fcu + CONNECTION_HANDLER_LORA_SESSION_CHECKPOINT);
+  _modem.setFCD(session.fcd);
+  trace(TraceEvent::JOIN, 1);
+
+  _session_restored = true;
+  _session_ack_failures = 0;
+  storeSession();
+  return true;
+}
+
+void LoRaConnectionHandler::storeSession()
+{
+  _session_uplinks = 0;
+  if (!_session_store) {
+    return;
+  }
+
+  LoRaSession session;
+  memset(&session, 0, sizeof(session));
+  session.version = CONNECTION_HANDLER_LORA_SESSION_VERSION;
+  session.band = _settings.lora.band;
+  session.credentials = credentials();
+  strncpy(session.devaddr, _modem.getDevAddr().c_str(), sizeof(session.devaddr)-1);
+  strncpy(session.nwkskey, _modem.getNwkSKey().c_str(), sizeof(session.nwkskey)-1);
+  strncpy(session.appskey, _modem.getAppSKey().c_str(), sizeof(session.appskey)-1);
+  session.fcu = static_cast<uint32_t>(_modem.getFCU());
+  session.fcd = static_cast<uint32_t>(_modem.getFCD());
+  session.crc = crc32(&session, offsetof(LoRaSession, crc));
+
+  if (!_session_store(session)) {
+    DEBUG_WARNING(F("Session could not be saved"));
+  }
+}
+
+uint32_t LoRaConnectionHandler::credentials() const
+{
+  return crc32(_settings.lora.appkey, strlen(_settings.lora.appkey),
+               crc32(_settings.lora.appeui, strlen(_settings.lora.appeui)));
+}
+
+size_t LoRaConnectionHandler::fragmentRoom()
+{
+  /* A frame is never larger than the buffer, whatever the data rate allows */
+  size_t const payload = maxPayload();
+  size_t const limit = payload < CONNECTION_HANDLER_LORA_MAX_PAYLOAD ? payload : CONNECTION_HANDLER_LORA_MAX_PAYLOAD;
+  return limit > LORA_FRAGMENT_HEADER_SIZE ? limit - LORA_FRAGMENT_HEADER_SIZE : 0;
+}
+
+void LoRaConnectionHandler::sendFragment()
+{
+  /* The data rate can change between two fragments, e.g. because of ADR */
+  size_t const room = fragmentRoom();
+  size_t const left = _frag_size - _frag_offset;
+  size_t const len = left < room ? left : room;
+  bool const last = (len == left) || (_frag_index == LORA_FRAGMENT_MAX_COUNT - 1);
+
+  if (!last || len == left) {
+    uint8_t fragment[CONNECTION_HANDLER_LORA_MAX_PAYLOAD];
+    fragment[0] = LORA_FRAGMENT_MARKER | _frag_id;
+    fragment[1] = (last ? 0x80 : 0x00) | _frag_index;
+    fragment[2] = static_cast<uint8_t>(_frag_offset);
+    fragment[3] = static_cast<uint8_t>(_frag_offset >> 8);
+    memcpy(&fragment[LORA_FRAGMENT_HEADER_SIZE], _frag_src + _frag_offset, len);
+
+    int const result = transmit(fragment, len + LORA_FRAGMENT_HEADER_SIZE, _frag_confirmed);
+    if (result > 0) {
+      _frag_stats.sent++;
+      _frag_offset += len;
+      _frag_index++;
+      _frag_attempts = 0;
+      if (!last) {
+        return;
+      }
+    } else if (++_frag_attempts < CONNECTION_HANDLER_LORA_FRAGMENT_ATTEMPTS) {
+      _frag_stats.retried++;
+      return;
+    }
+
+    /* Done, or the fragment could not be delivered */
+    _frag_src = nullptr;
+    if (_on_sent) {
+      _on_sent(result > 0 ? static_cast<int>(_frag_size) : result);
+    }
+    return;
+  }
+
+  /* The message doesn't fit in LORA_FRAGMENT_MAX_COUNT fragments at this data rate */
+  DEBUG_ERROR(F("Message too large for %d fragments"), LORA_FRAGMENT_MAX_COUNT);
+  _frag_src = nullptr;
+  if (_on_sent) {
+    _on_sent(LoRaCommunicationError::LORA_ERROR_MAX_PACKET_SIZE);
+  }
+}
+
+void LoRaConnectionHandler::reassemble(const uint8_t * fragment, size_t const size)
+{
+  uint8_t const id = fragment[0] & 0x0F;
+  bool const last = (fragment[1] & 0x80) != 0;
+  uint8_t const index = fragment[1] & 0x7F;
+  size_t const offset = fragment[2] | (static_cast<size_t>(fragment[3]) << 8);
+  size_t const len = size - LORA_FRAGMENT_HEADER_SIZE;
+
+  _frag_stats.received++;
+
+  if (id != _reasm_id) {
+    if (_reasm_complete) {
+      /* The previous message has not been read yet */
+      _frag_stats.dropped++;
+      return;
+    }
+    if (_reasm_id >= 0) {
+      _frag_stats.dropped++;
+    }
+    _reasm_id = id;
+    _reasm_bytes = 0;
+    _reasm_total = 0;
+    memset(_reasm_bitmap, 0, sizeof(_reasm_bitmap));
+  }
+
+  if (offset + len > CONNECTION_HANDLER_LORA_REASSEMBLY_SIZE) {
+    DEBUG_ERROR(F("Fragmented downlink larger than %d bytes"), CONNECTION_HANDLER_LORA_REASSEMBLY_SIZE);
+    _frag_stats.dropped++;
+    _reasm_id = -1;
+    return;
+  }
+
+  /* Repeated fragments, e.g. retransmissions, are counted once */
+  if ((_reasm_bitmap[index / 8] & (1 << (index % 8))) == 0) {
+    _reasm_bitmap[index / 8] |= (1 << (index % 8));
+    memcpy(&_reasm_data[offset], &fragment[LORA_FRAGMENT_HEADER_SIZE], len);
+    _reasm_bytes += len;
+  }
+  if (last) {
+    _reasm_total = offset + len;
+  }
+
+  if (_reasm_total > 0 && _reasm_bytes == _reasm_total) {
+    _reasm_complete = true;
+    _frag_stats.reassembled++;
+  }
+}
+
+void LoRaConnectionHandler::pollDownlink()
+{
+  /* The modem delivers a downlink as a whole, what is available is one packet */
+  int const length = _modem.available();
+  if (length <= 0) {
+    return;
+  }
+
+  if (_frag_enabled && _modem.peek() >= LORA_FRAGMENT_MARKER && length > LORA_FRAGMENT_HEADER_SIZE && length <= CONNECTION_HANDLER_LORA_MAX_PAYLOAD) {
+    uint8_t fragment[CONNECTION_HANDLER_LORA_MAX_PAYLOAD];
+    for (int i = 0; i < length; i++) {
+      fragment[i] = static_cast<uint8_t>(_modem.read());
+    }
+    reassemble(fragment, length);
+    return;
+  }
+
+  if (_rx_count >= CONNECTION_HANDLER_LORA_RX_QUEUE_SIZE) {
+    for (int i = 0; i < length; i++) {
+      _modem.read();
+    }
+    _rx_stats.dropped++;
+    return;
+  }
+
+  size_t const slot = (_rx_head + _rx_count) % CONNECTION_HANDLER_LORA_RX_QUEUE_SIZE;
+  for (int i = 0; i < length; i++) {
+    int const c = _modem.read();
+    if (i < CONNECTION_HANDLER_LORA_MAX_PAYLOAD) {
+      _rx_data[slot][i] = static_cast<uint8_t>(c);
+    }
+  }
+  if (length > CONNECTION_HANDLER_LORA_MAX_PAYLOAD) {
+    _rx_stats.truncated++;
+  }
+
+  LoRaPacketInfo & info = _rx_info[slot];
+  info.timestamp = millis();
+  info.length = length > 0xFF ? 0xFF : static_cast<uint8_t>(length);
+  info.port = LORA_PACKET_PORT_UNKNOWN;
+  info.rssi = LORA_PACKET_RSSI_UNKNOWN;
+  info.snr = LORA_PACKET_SNR_UNKNOWN;
+
+  _rx_count++;
+  _rx_stats.received++;
+}
+
+void LoRaConnectionHandler::popPacket()
+{
+  _rx_head = (_rx_head + 1) % CONNECTION_HANDLER_LORA_RX_QUEUE_SIZE;
+  _rx_count--;
+  _rx_offset = 0;
+}
+
 #endif
@@ -25,6 +25,132 @@
   #error "Board doesn't support LORA"
 #endif
 
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+/* Downlinks kept until read, and their maximum size: 242 bytes is the largest
+ * LoRaWAN application payload in any region.
+ */
+#ifndef CONNECTION_HANDLER_LORA_RX_QUEUE_SIZE
+  #define CONNECTION_HANDLER_LORA_RX_QUEUE_SIZE 4
+#endif
+
+#ifndef CONNECTION_HANDLER_LORA_MAX_PAYLOAD
+  #define CONNECTION_HANDLER_LORA_MAX_PAYLOAD 242
+#endif
+
+/* Messages waiting for their turn on air, send() fails when the queue is full */
+#ifndef CONNECTION_HANDLER_LORA_TX_QUEUE_SIZE
+  #define CONNECTION_HANDLER_LORA_TX_QUEUE_SIZE 4
+#endif
+
+/* Uplinks between two checkpoints of the frame counters to the session storage,
+ * the uplink counter is moved ahead by as much when a session is restored.
+ */
+#ifndef CONNECTION_HANDLER_LORA_SESSION_CHECKPOINT
+  #define CONNECTION_HANDLER_LORA_SESSION_CHECKPOINT 16
+#endif
+
+/* Consecutive unacknowledged confirmed uplinks after which a restored session is
+ * considered stale and the device joins again.
+ */
+#ifndef CONNECTION_HANDLER_LORA_SESSION_MAX_ACK_FAILURES
+  #define CONNECTION_HANDLER_LORA_SESSION_MAX_ACK_FAILURES 8
+#endif
+
+#define CONNECTION_HANDLER_LORA_SESSION_VERSION 1
+
+/* Fragmentation: largest downlink message reassembled, and attempts per uplink
+ * fragment before the transfer is abandoned.
+ */
+#ifndef CONNECTION_HANDLER_LORA_REASSEMBLY_SIZE
+  #define CONNECTION_HANDLER_LORA_REASSEMBLY_SIZE 512
+#endif
+
+#ifndef CONNECTION_HANDLER_LORA_FRAGMENT_ATTEMPTS
+  #define CONNECTION_HANDLER_LORA_FRAGMENT_ATTEMPTS 3
+#endif
+
+/* Fragment header, see extras/lora_fragment_decoder.py:
+ * 0xF0 | message id (4 bits), last flag (bit 7) | index (7 bits), offset (16 bits LE)
+ */
+#define LORA_FRAGMENT_MARKER      0xF0
+#define LORA_FRAGMENT_HEADER_SIZE 4
+#define LORA_FRAGMENT_MAX_COUNT   128
+
+/* Metadata not reported by the modem */
+#define LORA_PACKET_PORT_UNKNOWN 0
+#define LORA_PACKET_RSSI_UNKNOWN INT16_MIN
+#define LORA_PACKET_SNR_UNKNOWN  INT8_MIN
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+typedef enum
+{
+  LORA_ERROR_ACK_NOT_RECEIVED     = -1,
+  LORA_ERROR_GENERIC              = -2,
+  LORA_ERROR_WRONG_PARAM          = -3,
+  LORA_ERROR_COMMUNICATION_BUSY   = -4,
+  LORA_ERROR_MESSAGE_OVERFLOW     = -5,
+  LORA_ERROR_NO_NETWORK_AVAILABLE = -6,
+  LORA_ERROR_RX_PACKET            = -7,
+  LORA_ERROR_REASON_UNKNOWN       = -8,
+  LORA_ERROR_MAX_PACKET_SIZE      = -20
+} LoRaCommunicationError;
+
+/* Completion of send(): the number of bytes sent or a LoRaCommunicationError */
+typedef void (*OnLoRaSentCallback)(int const result);
+
+struct LoRaPacketInfo {
+  uint32_t timestamp; /* millis() when the downlink was taken from the modem */
+  uint8_t  length;    /* payload length, can be more than the bytes copied */
+  uint8_t  port;
+  int16_t  rssi;      /* dBm */
+  int8_t   snr;       /* dB */
+};
+
+/* Session state saved by the application, e.g. in EEPROM or flash. It is only
+ * restored if its CRC is valid and it was joined with the same keys and band.
+ */
+struct LoRaSession {
+  uint16_t version;
+  uint8_t  band;
+  uint8_t  reserved;
+  uint32_t credentials; /* CRC-32 of the AppEUI and AppKey used to join */
+  char     devaddr[9];
+  char     nwkskey[33];
+  char     appskey[33];
+  uint32_t fcu;
+  uint32_t fcd;
+  uint32_t crc;         /* CRC-32 of the fields above */
+};
+
+typedef bool (*OnLoRaSessionLoad)(LoRaSession & session);
+typedef bool (*OnLoRaSessionStore)(LoRaSession const & session);
+
+struct LoRaAirtimeStats {
+  uint32_t airtime;          /* ms spent transmitting uplinks */
+  uint32_t last_time_on_air; /* ms, of the last uplink */
+  uint32_t deferred;         /* uplinks which had to wait for the airtime budget */
+};
+
+struct LoRaFragmentStats {
+  uint32_t sent;        /* uplink fragments sent */
+  uint32_t retried;     /* uplink fragments sent again after a failure */
+  uint32_t received;    /* downlink fragments received */
+  uint32_t reassembled; /* downlink messages completed */
+  uint32_t dropped;     /* downlink messages lost, incomplete or not read in time */
+};
+
+struct LoRaRxStats {
+  uint32_t received;  /* downlinks queued */
+  uint32_t dropped;   /* downlinks lost because the queue was full */
+  uint32_t truncated; /* downlinks longer than CONNECTION_HANDLER_LORA_MAX_PAYLOAD */
+};
+
 
 /******************************************************************************
   CLASS DECLARATION
@@ -36,10 +162,76 @@ class LoRaConnectionHandler : public ConnectionHandler
 
     LoRaConnectionHandler(char const * appeui, char const * appkey, _lora_band const band = _lora_band::EU868, char const * channelMask = NULL, _lora_class const device_class = _lora_class::CLASS_A);
 
+    virtual NetworkConnectionState check() override;
+
+    /* Blocking confirmed uplink, returns the number of bytes sent or a LoRaCommunicationError */
     virtual int write(const uint8_t *buf, size_t size) override;
     virtual int read() override;
     virtual bool available() override;
 
+    /* Packet receive API: the downlinks are queued as a whole when they are received,
+     * read() and available() consume the same queue one byte at a time.
+     * readPacket() copies the oldest downlink into buf, truncated to size, and
+     * returns the number of bytes copied or 0 if none is queued.
+     */
+    int readPacket(uint8_t * buf, size_t const size, LoRaPacketInfo * info = nullptr);
+    size_t packetsAvailable();
+    inline LoRaRxStats getRxStats() const { return _rx_stats; }
+
+    /* Non-blocking transmit: the message is copied in a queue and sent by check() once
+     * CONNECTED and allowed by the airtime budget, the result is then reported to the
+     * callback. Only one message is in flight at a time, send() returns false if the
+     * queue is full or the message is larger than maxPayload(). Unconfirmed messages
+     * don't wait for the RX windows. The modem has no asynchronous ACK report: a
+     * confirmed message blocks the check() call sending it until the ACK is received
+     * or the modem gives up, which can take up to 10 s.
+     */
+    bool send(const uint8_t * buf, size_t const size, bool const confirmed = false);
+    inline bool isSending() const { return _tx_count > 0 || _frag_src != nullptr; }
+    inline size_t pendingMessages() const { return _tx_count; }
+    inline void onSent(OnLoRaSentCallback callback) { _on_sent = callback; }
+
+    /* Airtime budget: after each uplink the band stays silent so that the time on air
+     * doesn't exceed the given fraction, in per mille, of the elapsed time. It is the
+     * regulatory duty cycle of the band by default: 1% in EU868, EU433 and CN779, no
+     * limit elsewhere. write() fails with LORA_ERROR_COMMUNICATION_BUSY and send()
+     * waits until nextSendTime(), a millis() value, without calling the modem.
+     */
+    inline void setAirtimeBudget(uint16_t const permille) { _airtime_budget = permille; }
+    unsigned long nextSendTime() const;
+    /* Time on air, in ms, of an uplink with the given payload at the current data rate */
+    unsigned long timeOnAir(size_t const size);
+    inline LoRaAirtimeStats getAirtimeStats() const { return _airtime_stats; }
+
+    /* Fragmentation: messages larger than a frame are split in fragments sized for the
+     * data rate in use when each one is sent, every fragment carrying a 4 bytes
+     * header. The fragments go through the airtime budget like send(), the callback
+     * is called once with the message size or the error which ended the transfer.
+     * buf is not copied and has to stay valid while isSending() is true.
+     * Once fragmentation is enabled, by enableFragmentation() or the first
+     * sendFragmented(), downlinks starting with a fragment header are reassembled
+     * instead of being queued and readMessage() returns the completed message.
+     * Otherwise every downlink reaches read()/readPacket() unchanged.
+     */
+    inline void enableFragmentation(bool const enable) { _frag_enabled = enable; }
+    bool sendFragmented(const uint8_t * buf, size_t const size, bool const confirmed = false);
+    int readMessage(uint8_t * buf, size_t const size);
+    bool messageAvailable();
+    /* Largest application payload of a frame at the current data rate */
+    size_t maxPayload();
+    inline LoRaFragmentStats getFragmentStats() const { return _frag_stats; }
+
+    /* Session persistence: when a storage is provided the session saved after the
+     * last join is restored with an ABP activation instead of joining again, and
+     * the frame counters are saved every CONNECTION_HANDLER_LORA_SESSION_CHECKPOINT
+     * uplinks. The device joins again only if the saved session is not valid, its
+     * 16 bits uplink counter would wrap once the checkpoint interval is skipped, or
+     * it has been invalidated, by the application or by repeated missing ACKs.
+     */
+    inline void setSessionStorage(OnLoRaSessionLoad load, OnLoRaSessionStore store) { _session_load = load; _session_store = store; }
+    void invalidateSession();
+    inline bool isSessionRestored() const { return _session_restored; }
+
     inline String getVersion() { return _modem.version(); }
     inline String getDeviceEUI() { return _modem.deviceEUI(); }
     inline int getChannelMaskSize(_lora_band band) { return _modem.getChannelMaskSize(band); }
@@ -66,7 +258,64 @@ class LoRaConnectionHandler : public ConnectionHandler
 
   private:
 
+    int transmit(const uint8_t * buf, size_t const size, bool const confirmed);
+    bool restoreSession();
+    void storeSession();
+    uint32_t credentials() const;
+    void pollDownlink();
+    void popPacket();
+    size_t fragmentRoom();
+    void sendFragment();
+    void reassemble(const uint8_t * fragment, size_t const size);
+
     LoRaModem _modem;
+
+    uint8_t _rx_data[CONNECTION_HANDLER_LORA_RX_QUEUE_SIZE][CONNECTION_HANDLER_LORA_MAX_PAYLOAD];
+    LoRaPacketInfo _rx_info[CONNECTION_HANDLER_LORA_RX_QUEUE_SIZE];
+    size_t _rx_head = 0;
+    size_t _rx_count = 0;
+    size_t _rx_offset = 0; /* bytes of the oldest downlink already consumed by read() */
+    LoRaRxStats _rx_stats = {0, 0, 0};
+
+    struct TxMessage {
+      uint8_t data[CONNECTION_HANDLER_LORA_MAX_PAYLOAD];
+      uint8_t size;
+      bool    confirmed;
+    };
+
+    TxMessage _tx_queue[CONNECTION_HANDLER_LORA_TX_QUEUE_SIZE];
+    size_t _tx_head = 0;
+    size_t _tx_count = 0;
+    OnLoRaSentCallback _on_sent = nullptr;
+
+    uint16_t _airtime_budget;
+    unsigned long _tx_end = 0;        /* millis() at the end of the last uplink */
+    unsigned long _tx_off_time = 0;   /* silence required after it, ms */
+    LoRaAirtimeStats _airtime_stats = {0, 0, 0};
+
+    const uint8_t * _frag_src = nullptr;
+    size_t _frag_size = 0;
+    size_t _frag_offset = 0;
+    uint8_t _frag_index = 0;
+    uint8_t _frag_id = 0;
+    uint8_t _frag_attempts = 0;
+    bool _frag_confirmed = false;
+    bool _frag_enabled = false;
+
+    uint8_t _reasm_data[CONNECTION_HANDLER_LORA_REASSEMBLY_SIZE];
+    uint8_t _reasm_bitmap[LORA_FRAGMENT_MAX_COUNT / 8];
+    int _reasm_id = -1;
+    size_t _reasm_bytes = 0;
+    size_t _reasm_total = 0;   /* known once the last fragment is received */
+    bool _reasm_complete = false;
+    LoRaFragmentStats _frag_stats = {0, 0, 0, 0, 0};
+
+    OnLoRaSessionLoad _session_load = nullptr;
+    OnLoRaSessionStore _session_store = nullptr;
+    bool _session_invalid = false;
+    bool _session_restored = false;
+    unsigned int _session_uplinks = 0;
+    unsigned int _session_ack_failures = 0;
 };
 
 #endif /* ARDUINO_LORA_CONNECTION_HANDLER_H_ */
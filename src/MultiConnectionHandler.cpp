@@ -0,0 +1,409 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerDefinitions.h"
+
+#if !defined(BOARD_HAS_LORA)
+#include "MultiConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+/* The handlers are checked at this rate, each of them then advances
+ * its state machine according to its own TimeoutTable.
+ */
+static uint32_t const MULTI_POLL_INTERVAL = 100;
+
+/* Aggregated state, in order of precedence */
+static NetworkConnectionState const MULTI_STATE_PRECEDENCE[] = {
+  NetworkConnectionState::CONNECTED,
+  NetworkConnectionState::CONNECTING,
+  NetworkConnectionState::INIT,
+  NetworkConnectionState::DISCONNECTING,
+  NetworkConnectionState::DISCONNECTED,
+  NetworkConnectionState::ERROR,
+  NetworkConnectionState::CLOSED,
+};
+
+/******************************************************************************
+  CTOR/DTOR
+ ******************************************************************************/
+
+MultiConnectionHandler::MultiConnectionHandler(bool const keep_alive)
+: ConnectionHandler{keep_alive, NetworkAdapter::NONE}
+, _handlers_count{0}
+, _policy{RoutingPolicy::PRIORITY}
+, _routed{-1}
+{
+  for (unsigned int i = 0; i < sizeof(_timeoutTable.intervals) / sizeof(_timeoutTable.intervals[0]); i++) {
+    _timeoutTable.intervals[i] = MULTI_POLL_INTERVAL;
+  }
+}
+
+/******************************************************************************
+  PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+
+bool MultiConnectionHandler::addHandler(ConnectionHandler & handler)
+{
+  if (_handlers_count >= CONNECTION_HANDLER_MULTI_MAX_HANDLERS) {
+    DEBUG_ERROR(F("MultiConnectionHandler can hold up to %d handlers"), CONNECTION_HANDLER_MULTI_MAX_HANDLERS);
+    return false;
+  }
+
+  if (getHandler(handler.getInterface()) != nullptr) {
+    DEBUG_ERROR(F("A handler for network adapter %d is already present"), handler.getInterface());
+    return false;
+  }
+
+  handler.setKeepAlive(_keep_alive);
+  handler.enableCheckInternetAvailability(_check_internet_availability);
+
+  _handlers[_handlers_count] = &handler;
+  _states[_handlers_count] = NetworkConnectionState::INIT;
+  _handlers_count++;
+  return true;
+}
+
+ConnectionHandler * MultiConnectionHandler::getHandler(NetworkAdapter const adapter)
+{
+  for (size_t i = 0; i < _handlers_count; i++) {
+    if (_handlers[i]->getInterface() == adapter) {
+      return _handlers[i];
+    }
+  }
+  return nullptr;
+}
+
+NetworkConnectionState MultiConnectionHandler::getHandlerState(NetworkAdapter const adapter)
+{
+  for (size_t i = 0; i < _handlers_count; i++) {
+    if (_handlers[i]->getInterface() == adapter) {
+      return _states[i];
+    }
+  }
+  return NetworkConnectionState::CLOSED;
+}
+
+unsigned long MultiConnectionHandler::getTime() {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->getTime() : 0;
+}
+
+int MultiConnectionHandler::ping(IPAddress ip, uint8_t ttl, uint8_t count) {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->ping(ip, ttl, count) : 0;
+}
+
+int MultiConnectionHandler::ping(const String &hostname, uint8_t ttl, uint8_t count) {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->ping(hostname, ttl, count) : 0;
+}
+
+int MultiConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count) {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->ping(host, ttl, count) : 0;
+}
+
+int MultiConnectionHandler::resolve(const char * host, IPAddress & ip, IPFamily const family) {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->resolve(host, ip, family) : 0;
+}
+
+int MultiConnectionHandler::connectClient(Client & client, const char * host, uint16_t const port) {
+  /* NOTE the client has to belong to the routed handler, e.g. getClient() or acquireClient() */
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->connectClient(client, host, port) : 0;
+}
+
+RTTStats MultiConnectionHandler::measureRTT(const char * host, uint8_t const count, uint16_t const port) {
+  ConnectionHandler * ch = route();
+  if (ch != nullptr) {
+    _rtt_stats = ch->measureRTT(host, count, port);
+  }
+  return _rtt_stats;
+}
+
+RTTStats MultiConnectionHandler::measureRTT(NetworkAdapter const adapter, const char * host, uint8_t const count, uint16_t const port) {
+  ConnectionHandler * ch = getHandler(adapter);
+  return ch != nullptr ? ch->measureRTT(host, count, port) : RTTStats{0, 0, 0, 0, 0, RTTMethod::NONE};
+}
+
+Client & MultiConnectionHandler::getClient() {
+  return route()->getClient(); // NOTE route() may return nullptr
+}
+
+UDP & MultiConnectionHandler::getUDP() {
+  return route()->getUDP(); // NOTE route() may return nullptr
+}
+
+Client & MultiConnectionHandler::getClient(NetworkAdapter const adapter) {
+  ConnectionHandler * ch = getHandler(adapter);
+  return ch != nullptr ? ch->getClient() : getClient();
+}
+
+UDP & MultiConnectionHandler::getUDP(NetworkAdapter const adapter) {
+  ConnectionHandler * ch = getHandler(adapter);
+  return ch != nullptr ? ch->getUDP() : getUDP();
+}
+
+Client * MultiConnectionHandler::acquireClient() {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->acquireClient() : nullptr;
+}
+
+UDP * MultiConnectionHandler::acquireUDP() {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->acquireUDP() : nullptr;
+}
+
+Client * MultiConnectionHandler::acquireClient(NetworkAdapter const adapter) {
+  ConnectionHandler * ch = getHandler(adapter);
+  return ch != nullptr ? ch->acquireClient() : nullptr;
+}
+
+UDP * MultiConnectionHandler::acquireUDP(NetworkAdapter const adapter) {
+  ConnectionHandler * ch = getHandler(adapter);
+  return ch != nullptr ? ch->acquireUDP() : nullptr;
+}
+
+bool MultiConnectionHandler::releaseClient(Client * client) {
+  /* Only the handler owning the socket accepts it back */
+  for (size_t i = 0; i < _handlers_count; i++) {
+    if (_handlers[i]->releaseClient(client)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool MultiConnectionHandler::releaseUDP(UDP * udp) {
+  for (size_t i = 0; i < _handlers_count; i++) {
+    if (_handlers[i]->releaseUDP(udp)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+SocketPoolStats MultiConnectionHandler::getClientPoolStats() {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->getClientPoolStats() : ConnectionHandler::getClientPoolStats();
+}
+
+SocketPoolStats MultiConnectionHandler::getUDPPoolStats() {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->getUDPPoolStats() : ConnectionHandler::getUDPPoolStats();
+}
+
+bool MultiConnectionHandler::updateSetting(const models::NetworkSetting& s) {
+  ConnectionHandler * ch = getHandler(s.type);
+  return ch != nullptr ? ch->updateSetting(s) : false;
+}
+
+void MultiConnectionHandler::getSetting(models::NetworkSetting& s) {
+  /* The type of the provided setting selects the handler */
+  ConnectionHandler * ch = getHandler(s.type);
+  if (ch != nullptr) {
+    ch->getSetting(s);
+  } else {
+    s.type = NetworkAdapter::NONE;
+  }
+}
+
+void MultiConnectionHandler::applySettings() {
+  for (size_t i = 0; i < _handlers_count; i++) {
+    _handlers[i]->applySettings();
+  }
+}
+
+bool MultiConnectionHandler::hasPendingSetting() {
+  for (size_t i = 0; i < _handlers_count; i++) {
+    if (_handlers[i]->hasPendingSetting()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void MultiConnectionHandler::connect() {
+  for (size_t i = 0; i < _handlers_count; i++) {
+    _handlers[i]->connect();
+  }
+  ConnectionHandler::connect();
+}
+
+void MultiConnectionHandler::disconnect() {
+  for (size_t i = 0; i < _handlers_count; i++) {
+    _handlers[i]->disconnect();
+  }
+  ConnectionHandler::disconnect();
+}
+
+void MultiConnectionHandler::setKeepAlive(bool keep_alive) {
+  _keep_alive = keep_alive;
+
+  for (size_t i = 0; i < _handlers_count; i++) {
+    _handlers[i]->setKeepAlive(keep_alive);
+  }
+}
+
+NetworkAdapter MultiConnectionHandler::getRoutedAdapter() {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->getInterface() : NetworkAdapter::NONE;
+}
+
+ConnectionQuality MultiConnectionHandler::getQuality() {
+  ConnectionHandler * ch = route();
+  return ch != nullptr ? ch->getQuality() : ConnectionHandler::getQuality();
+}
+
+ConnectionQuality MultiConnectionHandler::getQuality(NetworkAdapter const adapter) {
+  ConnectionHandler * ch = getHandler(adapter);
+  return ch != nullptr ? ch->getQuality() : ConnectionQuality{0, CONNECTION_HANDLER_QUALITY_UNKNOWN, CONNECTION_HANDLER_QUALITY_UNKNOWN, CONNECTION_HANDLER_QUALITY_UNKNOWN, 0};
+}
+
+EnergyStats MultiConnectionHandler::getEnergyStats() {
+  EnergyStats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  for (size_t i = 0; i < _handlers_count; i++) {
+    EnergyStats const s = _handlers[i]->getEnergyStats();
+    for (unsigned int j = 0; j < CONNECTION_HANDLER_STATES_COUNT; j++) {
+      stats.time[j] += s.time[j];
+    }
+    stats.radio_on_time += s.radio_on_time;
+    stats.charge += s.charge;
+  }
+  return stats;
+}
+
+EnergyStats MultiConnectionHandler::getEnergyStats(NetworkAdapter const adapter) {
+  ConnectionHandler * ch = getHandler(adapter);
+  if (ch != nullptr) {
+    return ch->getEnergyStats();
+  }
+
+  EnergyStats stats;
+  memset(&stats, 0, sizeof(stats));
+  return stats;
+}
+
+void MultiConnectionHandler::resetEnergyStats() {
+  for (size_t i = 0; i < _handlers_count; i++) {
+    _handlers[i]->resetEnergyStats();
+  }
+  ConnectionHandler::resetEnergyStats();
+}
+
+/******************************************************************************
+  PROTECTED MEMBER FUNCTIONS
+ ******************************************************************************/
+
+NetworkConnectionState MultiConnectionHandler::updateConnectionState() {
+  for (size_t i = 0; i < _handlers_count; i++) {
+    _states[i] = _handlers[i]->check();
+  }
+  if (_policy == RoutingPolicy::BEST_SCORE) {
+    rank();
+  }
+  return aggregateState();
+}
+
+NetworkConnectionState MultiConnectionHandler::update_handleInit() {
+  return aggregateState();
+}
+
+NetworkConnectionState MultiConnectionHandler::update_handleConnecting() {
+  return aggregateState();
+}
+
+NetworkConnectionState MultiConnectionHandler::update_handleConnected() {
+  return aggregateState();
+}
+
+NetworkConnectionState MultiConnectionHandler::update_handleDisconnecting() {
+  return aggregateState();
+}
+
+NetworkConnectionState MultiConnectionHandler::update_handleDisconnected() {
+  return aggregateState();
+}
+
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+ConnectionHandler * MultiConnectionHandler::route() {
+  if (_policy == RoutingPolicy::BEST_SCORE && _routed >= 0 && _states[_routed] == NetworkConnectionState::CONNECTED) {
+    return _handlers[_routed];
+  }
+  for (size_t i = 0; i < _handlers_count; i++) {
+    if (_states[i] == NetworkConnectionState::CONNECTED) {
+      return _handlers[i];
+    }
+  }
+  return _handlers_count > 0 ? _handlers[0] : nullptr;
+}
+
+void MultiConnectionHandler::rank() {
+  int best = -1;
+  uint8_t best_score = 0;
+  int routed_score = -1;
+
+  for (size_t i = 0; i < _handlers_count; i++) {
+    if (_states[i] != NetworkConnectionState::CONNECTED) {
+      continue;
+    }
+    uint8_t const score = _handlers[i]->getQuality().score;
+    if (static_cast<int>(i) == _routed) {
+      routed_score = score;
+    }
+    if (best < 0 || score > best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+
+  if (best < 0 || best == _routed) {
+    return;
+  }
+
+  /* Hysteresis: the handler in use is kept unless it is clearly outperformed */
+  if (routed_score >= 0 && best_score < routed_score + CONNECTION_HANDLER_QUALITY_HYSTERESIS) {
+    return;
+  }
+
+  DEBUG_INFO(F("Routing to network adapter %d, score %d"), _handlers[best]->getInterface(), best_score);
+  _routed = best;
+}
+
+NetworkConnectionState MultiConnectionHandler::aggregateState() {
+  if (_handlers_count == 0) {
+    return NetworkConnectionState::INIT;
+  }
+
+  for (NetworkConnectionState const state : MULTI_STATE_PRECEDENCE) {
+    for (size_t i = 0; i < _handlers_count; i++) {
+      if (_states[i] == state) {
+        return state;
+      }
+    }
+  }
+  return NetworkConnectionState::CLOSED;
+}
+
+#endif /* !defined(BOARD_HAS_LORA) */
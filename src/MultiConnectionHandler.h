@@ -0,0 +1,147 @@
+/*
+  This file is part of the Arduino_ConnectionHandler library.
+
+  Copyright (c) 2024 Arduino SA
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef ARDUINO_MULTI_CONNECTION_HANDLER_H_
+#define ARDUINO_MULTI_CONNECTION_HANDLER_H_
+
+/******************************************************************************
+  INCLUDE
+ ******************************************************************************/
+
+#include "ConnectionHandlerInterface.h"
+
+#if !defined(BOARD_HAS_LORA)
+
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#ifndef CONNECTION_HANDLER_MULTI_MAX_HANDLERS
+  #define CONNECTION_HANDLER_MULTI_MAX_HANDLERS 3
+#endif
+
+/******************************************************************************
+  TYPEDEFS
+ ******************************************************************************/
+
+enum class RoutingPolicy {
+  PRIORITY,   /* the first CONNECTED handler in the order they were added */
+  BEST_SCORE  /* the CONNECTED handler with the best ConnectionQuality score */
+};
+
+/******************************************************************************
+  CLASS DECLARATION
+ ******************************************************************************/
+
+/** MultiConnectionHandler class
+ * This class keeps several connectionHandlers, each one driving a different
+ * network adapter, active at the same time. Their states are aggregated into
+ * a single one: the MultiConnectionHandler is CONNECTED as long as at least
+ * one of its handlers is CONNECTED.
+ * Client and UDP objects can be requested for a specific adapter, otherwise
+ * they are routed according to the RoutingPolicy, by default to the first
+ * CONNECTED handler in the order they were added.
+ */
+class MultiConnectionHandler : public ConnectionHandler
+{
+  public:
+
+    MultiConnectionHandler(bool const keep_alive=true);
+
+    /* The handlers are kept in the order they are added, which is their routing priority */
+    bool addHandler(ConnectionHandler & handler);
+    ConnectionHandler * getHandler(NetworkAdapter const adapter);
+    NetworkConnectionState getHandlerState(NetworkAdapter const adapter);
+
+    /* With BEST_SCORE the routed handler is replaced only by one scoring at least
+     * CONNECTION_HANDLER_QUALITY_HYSTERESIS points more, or when it disconnects.
+     */
+    inline void setRoutingPolicy(RoutingPolicy const policy) { _policy = policy; }
+    inline RoutingPolicy getRoutingPolicy() const { return _policy; }
+    NetworkAdapter getRoutedAdapter() override;
+
+    int ping(IPAddress ip, uint8_t ttl = 128, uint8_t count = 1) override;
+    int ping(const String &hostname, uint8_t ttl = 128, uint8_t count = 1) override;
+    int ping(const char* host, uint8_t ttl = 128, uint8_t count = 1) override;
+
+    int resolve(const char * host, IPAddress & ip, IPFamily const family = IPFamily::IPV4) override;
+    int connectClient(Client & client, const char * host, uint16_t const port) override;
+
+    /* Measured on the routed handler, or on the one of the given adapter */
+    RTTStats measureRTT(const char * host, uint8_t const count = 4, uint16_t const port = 443) override;
+    RTTStats measureRTT(NetworkAdapter const adapter, const char * host, uint8_t const count = 4, uint16_t const port = 443);
+
+    unsigned long getTime() override;
+
+    /*
+     * NOTE: at least one handler has to be added before calling the following functions,
+     * if none of the handlers is CONNECTED the sockets of the first one are returned.
+     */
+    Client & getClient() override;
+    UDP & getUDP() override;
+    Client & getClient(NetworkAdapter const adapter);
+    UDP & getUDP(NetworkAdapter const adapter);
+
+    /* Pooled sockets are acquired from the routed handler or from the one of the given adapter */
+    Client * acquireClient() override;
+    UDP * acquireUDP() override;
+    Client * acquireClient(NetworkAdapter const adapter);
+    UDP * acquireUDP(NetworkAdapter const adapter);
+    bool releaseClient(Client * client) override;
+    bool releaseUDP(UDP * udp) override;
+
+    SocketPoolStats getClientPoolStats() override;
+    SocketPoolStats getUDPPoolStats() override;
+
+    bool updateSetting(const models::NetworkSetting& s) override;
+    void getSetting(models::NetworkSetting& s) override;
+    void applySettings() override;
+    bool hasPendingSetting() override;
+
+    void connect() override;
+    void disconnect() override;
+
+    void setKeepAlive(bool keep_alive=true) override;
+
+    /* The figures of all the handlers are summed up, or those of a single adapter */
+    EnergyStats getEnergyStats() override;
+    EnergyStats getEnergyStats(NetworkAdapter const adapter);
+    void resetEnergyStats() override;
+
+    /* The quality of the routed handler, or of the one of the given adapter */
+    ConnectionQuality getQuality() override;
+    ConnectionQuality getQuality(NetworkAdapter const adapter);
+
+  protected:
+
+    NetworkConnectionState updateConnectionState() override;
+
+    NetworkConnectionState update_handleInit         () override;
+    NetworkConnectionState update_handleConnecting   () override;
+    NetworkConnectionState update_handleConnected    () override;
+    NetworkConnectionState update_handleDisconnecting() override;
+    NetworkConnectionState update_handleDisconnected () override;
+
+  private:
+
+    ConnectionHandler * route();
+    void rank();
+    NetworkConnectionState aggregateState();
+
+    ConnectionHandler * _handlers[CONNECTION_HANDLER_MULTI_MAX_HANDLERS];
+    NetworkConnectionState _states[CONNECTION_HANDLER_MULTI_MAX_HANDLERS];
+    size_t _handlers_count;
+    RoutingPolicy _policy;
+    int _routed;
+};
+
+#endif /* !defined(BOARD_HAS_LORA) */
+
+#endif /* ARDUINO_MULTI_CONNECTION_HANDLER_H_ */
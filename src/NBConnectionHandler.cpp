@@ -16,6 +16,7 @@
 
 #ifdef BOARD_HAS_NB /* Only compile if this is a board with NB */
 #include "NBConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
   CONSTANTS
@@ -40,7 +41,10 @@ __attribute__((weak)) void mkr_nb_feed_watchdog()
  ******************************************************************************/
 
 NBConnectionHandler::NBConnectionHandler()
-: ConnectionHandler(true, NetworkAdapter::NB) {}
+: ConnectionHandler(true, NetworkAdapter::NB) {
+  _client_pool = &_nb_client_pool;
+  _udp_pool = &_nb_udp_pool;
+}
 
 NBConnectionHandler::NBConnectionHandler(char const * pin, bool const keep_alive)
 : NBConnectionHandler(pin, "", keep_alive)
@@ -58,6 +62,8 @@ NBConnectionHandler::NBConnectionHandler(char const * pin, char const * apn, cha
 : ConnectionHandler{keep_alive, NetworkAdapter::NB}
 {
   _settings.type = NetworkAdapter::NB;
+  _client_pool = &_nb_client_pool;
+  _udp_pool = &_nb_udp_pool;
   strncpy(_settings.nb.pin, pin, sizeof(_settings.nb.pin)-1);
   strncpy(_settings.nb.apn, apn, sizeof(_settings.nb.apn)-1);
   strncpy(_settings.nb.login, login, sizeof(_settings.nb.login)-1);
@@ -73,16 +79,39 @@ unsigned long NBConnectionHandler::getTime()
   return _nb.getTime();
 }
 
+/* The modem has no ICMP echo: the time to open a TCP connection to port 443 is
+ * returned instead, in ms, or -1 if no probe got an answer.
+ */
 int NBConnectionHandler::ping(IPAddress ip, uint8_t ttl, uint8_t count) {
-  return 0;
+  (void)ttl;
+  int rtt = -1;
+  for (uint8_t i = 0; i < count && rtt < 0; i++) {
+    rtt = tcpRTT(nullptr, ip, 443);
+  }
+  return rtt;
 }
 
 int NBConnectionHandler::ping(const String &hostname, uint8_t ttl, uint8_t count) {
-  return 0;
+  return ping(hostname.c_str(), ttl, count);
 }
 
 int NBConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count) {
-  return 0;
+  (void)ttl;
+  RTTStats const stats = measureRTT(host, count);
+  return stats.received > 0 ? static_cast<int>(stats.avg) : -1;
+}
+
+/******************************************************************************
+  PROTECTED MEMBER FUNCTIONS
+ ******************************************************************************/
+
+int NBConnectionHandler::hostByName(const char * host, IPAddress & ip, IPFamily const family)
+{
+  /* MKRNB only exposes IPv4 addresses */
+  if (family == IPFamily::IPV6) {
+    return 0;
+  }
+  return _nb_gprs.hostByName(host, ip) == 1 ? 1 : 0;
 }
 
 /******************************************************************************
@@ -93,36 +122,85 @@ NetworkConnectionState NBConnectionHandler::update_handleInit()
 {
   mkr_nb_feed_watchdog();
 
-  if (_nb.begin(_settings.nb.pin,
-                _settings.nb.apn,
-                _settings.nb.login,
-                _settings.nb.pass) == NB_READY)
+  if (step() == 0)
   {
+    /* Start the modem without waiting for SIM unlock and network registration,
+     * their completion is polled on the next check() calls.
+     */
+    _profiles.apply(_settings.nb);
+    NB_NetworkStatus_t const nb_status = _nb.begin(_settings.nb.pin,
+                                                   _settings.nb.apn,
+                                                   _settings.nb.login,
+                                                   _settings.nb.pass,
+                                                   true,
+                                                   false);
+    trace(TraceEvent::BEGIN, static_cast<int32_t>(nb_status));
+    nextStep();
+    return NetworkConnectionState::INIT;
+  }
+
+  if (step() == 1)
+  {
+    int const nb_ready = _nb.ready();
+    if (nb_ready == 0 && stepElapsed() < NB_TIMEOUT)
+    {
+      return NetworkConnectionState::INIT;
+    }
+    if (nb_ready != 1)
+    {
+      trace(TraceEvent::FAILURE, nb_ready);
+      if (nb_ready == 0) {
+        DEBUG_ERROR(F("SIM unlock or network registration timed out"));
+      } else {
+        DEBUG_ERROR(F("SIM not present or wrong PIN"));
+      }
+      if (_profiles.next()) {
+        resetStep();
+        return NetworkConnectionState::INIT;
+      }
+      return NetworkConnectionState::ERROR;
+    }
+
     DEBUG_INFO(F("SIM card ok"));
     _nb.setTimeout(NB_TIMEOUT);
-    return NetworkConnectionState::CONNECTING;
+
+    /* The attach is started here rather than in CONNECTING, where the DNS cache is
+     * warmed up, so that no other command is sent to the modem while it runs.
+     */
+    NB_NetworkStatus_t const network_status = _nb_gprs.attachGPRS(false);
+    DEBUG_DEBUG(F("GPRS.attachGPRS(): %d"), network_status);
+    (void)network_status; /* only logged */
+    nextStep();
+    return NetworkConnectionState::INIT;
   }
-  else
+
+  int const gprs_ready = _nb_gprs.ready();
+  if (gprs_ready == 0 && stepElapsed() < NB_TIMEOUT)
   {
-    DEBUG_ERROR(F("SIM not present or wrong PIN"));
-    return NetworkConnectionState::ERROR;
+    return NetworkConnectionState::INIT;
   }
-}
 
-NetworkConnectionState NBConnectionHandler::update_handleConnecting()
-{
-  NB_NetworkStatus_t const network_status = _nb_gprs.attachGPRS(true);
-  DEBUG_DEBUG(F("GPRS.attachGPRS(): %d"), network_status);
-  if (network_status == NB_NetworkStatus_t::NB_ERROR)
+  trace(TraceEvent::ATTACH, gprs_ready);
+  DEBUG_DEBUG(F("GPRS.ready(): %d"), gprs_ready);
+  if (gprs_ready != 1)
   {
     DEBUG_ERROR(F("GPRS.attachGPRS() failed"));
+    /* The APN is set by NB.begin(), the modem has to be started again */
+    if (_profiles.next()) {
+      resetStep();
+      return NetworkConnectionState::INIT;
+    }
     return NetworkConnectionState::ERROR;
   }
-  else
-  {
-    DEBUG_INFO(F("Connected to GPRS Network"));
-    return NetworkConnectionState::CONNECTED;
-  }
+
+  _profiles.connected();
+  return NetworkConnectionState::CONNECTING;
+}
+
+NetworkConnectionState NBConnectionHandler::update_handleConnecting()
+{
+  DEBUG_INFO(F("Connected to GPRS Network"));
+  return NetworkConnectionState::CONNECTED;
 }
 
 NetworkConnectionState NBConnectionHandler::update_handleConnected()
@@ -131,6 +209,7 @@ NetworkConnectionState NBConnectionHandler::update_handleConnected()
   DEBUG_VERBOSE(F("GPRS.isAccessAlive(): %d"), nb_is_access_alive);
   if (nb_is_access_alive != 1)
   {
+    trace(TraceEvent::STATUS, nb_is_access_alive);
     DEBUG_INFO(F("Disconnected from cellular network"));
     return NetworkConnectionState::DISCONNECTED;
   }
@@ -145,6 +224,7 @@ NetworkConnectionState NBConnectionHandler::update_handleDisconnecting()
 {
   DEBUG_VERBOSE(F("Disconnecting from Cellular Network"));
   _nb.shutdown();
+  trace(TraceEvent::END);
   return NetworkConnectionState::DISCONNECTED;
 }
 
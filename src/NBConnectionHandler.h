@@ -16,6 +16,7 @@
  ******************************************************************************/
 
 #include "ConnectionHandlerInterface.h"
+#include "ConnectionHandlerCellularProfiles.h"
 
 #ifdef ARDUINO_SAMD_MKRNB1500
   #include <MKRNB.h>
@@ -45,8 +46,13 @@ class NBConnectionHandler : public ConnectionHandler
     virtual Client & getClient() override { return _nb_client; };
     virtual UDP & getUDP() override { return _nb_udp; }
 
+    /* Fallback PIN/APN/SIM profiles, used in place of the settings when any is added */
+    inline CellularProfileList & getProfiles() { return _profiles; }
+
   protected:
 
+    virtual int hostByName(const char * host, IPAddress & ip, IPFamily const family) override;
+
     virtual NetworkConnectionState update_handleInit         () override;
     virtual NetworkConnectionState update_handleConnecting   () override;
     virtual NetworkConnectionState update_handleConnected    () override;
@@ -56,12 +62,17 @@ class NBConnectionHandler : public ConnectionHandler
 
   private:
 
+    CellularProfileList _profiles;
+
     void changeConnectionState(NetworkConnectionState _newState);
 
     NB _nb;
     GPRS _nb_gprs;
     NBUDP _nb_udp;
     NBClient _nb_client;
+
+    SocketPool<Client, NBClient, CONNECTION_HANDLER_CLIENT_POOL_SIZE> _nb_client_pool;
+    SocketPool<UDP, NBUDP, CONNECTION_HANDLER_UDP_POOL_SIZE> _nb_udp_pool;
 };
 
 #endif /* #ifndef NB_CONNECTION_MANAGER_H_ */
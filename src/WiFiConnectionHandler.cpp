@@ -16,12 +16,16 @@
 
 #ifdef BOARD_HAS_WIFI /* Only compile if the board has WiFi */
 #include "WiFiConnectionHandler.h"
+#include "ConnectionHandlerDebug.h"
 
 /******************************************************************************
   CONSTANTS
  ******************************************************************************/
+/* WiFi.begin() returns before the station is connected on these cores */
 #if defined(ARDUINO_ARCH_ESP8266)
 static int const ESP_WIFI_CONNECTION_TIMEOUT = 3000;
+#elif defined(ARDUINO_ARCH_ESP32)
+static int const ESP_WIFI_CONNECTION_TIMEOUT = 10000;
 #endif
 
 /******************************************************************************
@@ -30,12 +34,16 @@ static int const ESP_WIFI_CONNECTION_TIMEOUT = 3000;
 
 WiFiConnectionHandler::WiFiConnectionHandler()
 : ConnectionHandler(true, NetworkAdapter::WIFI) {
+  _client_pool = &_wifi_client_pool;
+  _udp_pool = &_wifi_udp_pool;
 }
 
 WiFiConnectionHandler::WiFiConnectionHandler(char const * ssid, char const * pass, bool const keep_alive)
 : ConnectionHandler{keep_alive, NetworkAdapter::WIFI}
 {
   _settings.type = NetworkAdapter::WIFI;
+  _client_pool = &_wifi_client_pool;
+  _udp_pool = &_wifi_udp_pool;
   strncpy(_settings.wifi.ssid, ssid, sizeof(_settings.wifi.ssid)-1);
   strncpy(_settings.wifi.pwd, pass, sizeof(_settings.wifi.pwd)-1);
 }
@@ -55,60 +63,182 @@ unsigned long WiFiConnectionHandler::getTime()
 #endif
 }
 
+bool WiFiConnectionHandler::addProfile(char const * ssid, char const * pass, uint8_t const priority)
+{
+  if (_profiles_count >= CONNECTION_HANDLER_WIFI_MAX_PROFILES) {
+    return false;
+  }
+
+  models::WiFiProfile & profile = _profiles[_profiles_count];
+  memset(&profile, 0, sizeof(profile));
+  strncpy(profile.wifi.ssid, ssid, sizeof(profile.wifi.ssid)-1);
+  strncpy(profile.wifi.pwd, pass, sizeof(profile.wifi.pwd)-1);
+  profile.priority = priority;
+  _profiles_count++;
+  return true;
+}
+
 int WiFiConnectionHandler::ping(IPAddress ip, uint8_t ttl, uint8_t count) {
 #if !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32) && !defined(ARDUINO_ARCH_ZEPHYR)
-  return WiFi.ping(ip);
+  return WiFi.ping(ip, ttl);
 #else
   return 0;
 #endif
 }
 
 int WiFiConnectionHandler::ping(const String &hostname, uint8_t ttl, uint8_t count) {
-#if !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32) && !defined(ARDUINO_ARCH_ZEPHYR)
-  return WiFi.ping(hostname);
-#else
-  return 0;
-#endif
+  return ping(hostname.c_str(), ttl, count);
 }
 
 int WiFiConnectionHandler::ping(const char* host, uint8_t ttl, uint8_t count) {
 #if !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32) && !defined(ARDUINO_ARCH_ZEPHYR)
-  return WiFi.ping(host);
+  IPAddress ip;
+  if (resolve(host, ip) == 1) {
+    return WiFi.ping(ip, ttl);
+  }
+  return WiFi.ping(host, ttl);
 #else
   return 0;
 #endif
 }
 
+#if defined(ARDUINO_ARCH_ESP8266)
+static_assert(sizeof(TLSSession) == sizeof(br_ssl_session_parameters), "TLSSession doesn't match br_ssl_session_parameters");
+
+int WiFiConnectionHandler::connectSecure(BearSSL::WiFiClientSecure & client, const char * host, uint16_t const port)
+{
+  if (_tls_session_cache == nullptr) {
+    return client.connect(host, port);
+  }
+
+  /* TLSSession has the layout of br_ssl_session_parameters, an empty session
+   * id makes BearSSL run a full handshake.
+   */
+  TLSSession session;
+  bool const cached = _tls_session_cache->lookup(host, port, session);
+  if (!cached) {
+    memset(&session, 0, sizeof(session));
+  }
+  memcpy(_tls_session.getSession(), &session, sizeof(br_ssl_session_parameters));
+
+  /* The name is used for SNI and certificate validation, no resolve() here */
+  client.setSession(&_tls_session);
+  int const res = client.connect(host, port);
+  client.setSession(nullptr);
+
+  if (res != 1) {
+    /* Don't offer the same session again to a server which may have refused it */
+    if (cached) {
+      _tls_session_cache->invalidate(host, port);
+    }
+    return res;
+  }
+
+  /* A new session replaces the cached one when the server didn't resume it */
+  memcpy(&session, _tls_session.getSession(), sizeof(br_ssl_session_parameters));
+  if (session.session_id_len > 0) {
+    _tls_session_cache->store(host, port, session);
+  }
+  return res;
+}
+#endif
+
 /******************************************************************************
   PROTECTED MEMBER FUNCTIONS
  ******************************************************************************/
 
+int WiFiConnectionHandler::icmpRTT(IPAddress const & ip)
+{
+#if !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32) && !defined(ARDUINO_ARCH_ZEPHYR)
+  return WiFi.ping(ip);
+#else
+  (void)ip;
+  return -1;
+#endif
+}
+
+int WiFiConnectionHandler::linkQuality()
+{
+#if !defined(ARDUINO_ARCH_ZEPHYR)
+  /* From -90 dBm, barely usable, to -50 dBm */
+  int32_t const rssi = WiFi.RSSI();
+  if (rssi >= 0) {
+    return -1;
+  }
+  return rssi <= -90 ? 0 : (rssi >= -50 ? 100 : (rssi + 90) * 100 / 40);
+#else
+  return -1;
+#endif
+}
+
+#if defined(ARDUINO_ARCH_MBED) || defined(ARDUINO_ARCH_ESP32)
+int WiFiConnectionHandler::connectTimeout(Client & client, IPAddress const & ip, uint16_t const port, unsigned long const timeout)
+{
+#if defined(ARDUINO_ARCH_MBED)
+  /* The timeout is a setting of the client with no getter: only the pooled
+   * clients are bounded, getClient() keeps the timeout of the application.
+   */
+  WiFiClient * wifi_client = _wifi_client_pool.find(&client);
+  if (wifi_client == nullptr) {
+    return client.connect(ip, port);
+  }
+  wifi_client->setConnectionTimeout(timeout);
+  return wifi_client->connect(ip, port);
+#else
+  /* Only the clients known to be WiFiClient can be bounded */
+  WiFiClient * wifi_client = (&client == &_wifi_client) ? &_wifi_client : _wifi_client_pool.find(&client);
+  if (wifi_client == nullptr) {
+    return client.connect(ip, port);
+  }
+  return wifi_client->connect(ip, port, static_cast<int32_t>(timeout));
+#endif
+}
+#endif
+
+int WiFiConnectionHandler::hostByName(const char * host, IPAddress & ip, IPFamily const family)
+{
+#if defined(ARDUINO_ARCH_MBED)
+  if (family == IPFamily::IPV6) {
+    return mbed_host_by_name(WiFi.getNetwork(), host, ip, family);
+  }
+#else
+  if (family == IPFamily::IPV6) {
+    return 0;
+  }
+#endif
+#if !defined(ARDUINO_ARCH_ZEPHYR)
+  return WiFi.hostByName(host, ip) == 1 ? 1 : 0;
+#else
+  return 0;
+#endif
+}
+
 NetworkConnectionState WiFiConnectionHandler::update_handleInit()
 {
-#if !defined(__AVR__)
-  DEBUG_INFO(F("WiFi.status(): %d"), WiFi.status());
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  /* A connection attempt is in progress, poll it without calling WiFi.begin() again */
+  if ((step() > 0) && (WiFi.status() != WL_CONNECTED) && (stepElapsed() < ESP_WIFI_CONNECTION_TIMEOUT)) {
+    return NetworkConnectionState::INIT;
+  }
 #endif
 
+  DEBUG_INFO(F("WiFi.status(): %d"), WiFi.status());
+
 #if !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32)
   if (WiFi.status() == NETWORK_HARDWARE_ERROR)
   {
-#if !defined(__AVR__)
+    trace(TraceEvent::FAILURE, NETWORK_HARDWARE_ERROR);
     DEBUG_ERROR(F("WiFi Hardware failure.\nMake sure you are using a WiFi enabled board/shield."));
     DEBUG_ERROR(F("Then reset and retry."));
-#endif
     return NetworkConnectionState::ERROR;
   }
-#if !defined(__AVR__)
   DEBUG_INFO(F("Current WiFi Firmware: %s"), WiFi.firmwareVersion());
-#endif
 
 #if defined(WIFI_FIRMWARE_VERSION_REQUIRED)
   if (String(WiFi.firmwareVersion()) < String(WIFI_FIRMWARE_VERSION_REQUIRED))
   {
-#if !defined(__AVR__)
     DEBUG_ERROR(F("Latest WiFi Firmware: %s"), WIFI_FIRMWARE_VERSION_REQUIRED);
     DEBUG_ERROR(F("Please update to the latest version for best performance."));
-#endif
     delay(5000);
   }
 #endif
@@ -116,32 +246,42 @@ NetworkConnectionState WiFiConnectionHandler::update_handleInit()
   WiFi.mode(WIFI_STA);
 #endif /* #if !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32) */
 
-  if (WiFi.status() != WL_CONNECTED)
+  if ((WiFi.status() != WL_CONNECTED) && (step() == 0))
   {
-    WiFi.begin(_settings.wifi.ssid, _settings.wifi.pwd);
-#if defined(ARDUINO_ARCH_ESP8266)
-    /* Wait connection otherwise board won't connect */
-    unsigned long start = millis();
-    while((WiFi.status() != WL_CONNECTED) && (millis() - start) < ESP_WIFI_CONNECTION_TIMEOUT) {
-      delay(100);
+    if (_profiles_count > 0) {
+      _profile = selectProfile();
+      _settings.wifi = _profiles[_profile].wifi;
     }
+    trace(TraceEvent::BEGIN, WiFi.begin(_settings.wifi.ssid, _settings.wifi.pwd));
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+    /* Wait connection otherwise board won't connect: the status is polled on
+     * the next check() calls until ESP_WIFI_CONNECTION_TIMEOUT is elapsed.
+     */
+    nextStep();
+    return NetworkConnectionState::INIT;
 #endif
-
   }
 
   if (WiFi.status() != NETWORK_CONNECTED)
   {
-#if !defined(__AVR__)
+    trace(TraceEvent::STATUS, WiFi.status());
     DEBUG_ERROR(F("Connection to \"%s\" failed"), _settings.wifi.ssid);
     DEBUG_INFO(F("Retrying in  \"%d\" milliseconds"), _timeoutTable.timeout.init);
-#endif
+    /* Rescan before the next attempt, the connection timeout has expired, and
+     * give the other profiles a chance
+     */
+    _last_good_profile = -1;
+    if (_profile >= 0) {
+      _failed_profiles |= 1UL << _profile;
+    }
+    resetStep();
     return NetworkConnectionState::INIT;
   }
   else
   {
-#if !defined(__AVR__)
     DEBUG_INFO(F("Connected to \"%s\""), _settings.wifi.ssid);
-#endif
+    _last_good_profile = _profile;
+    _failed_profiles = 0;
 #if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
   configTime(0, 0, "time.arduino.cc", "pool.ntp.org", "time.nist.gov");
 #endif
@@ -161,6 +301,7 @@ NetworkConnectionState WiFiConnectionHandler::update_handleConnecting()
 
   #if !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32)
   int ping_result = ping("time.arduino.cc");
+  trace(TraceEvent::PING, ping_result);
   DEBUG_INFO(F("WiFi.ping(): %d"), ping_result);
   if (ping_result < 0)
   {
@@ -178,15 +319,12 @@ NetworkConnectionState WiFiConnectionHandler::update_handleConnected()
 {
   if (WiFi.status() != WL_CONNECTED)
   {
-#if !defined(__AVR__)
+    trace(TraceEvent::STATUS, WiFi.status());
     DEBUG_VERBOSE(F("WiFi.status(): %d"), WiFi.status());
     DEBUG_ERROR(F("Connection to \"%s\" lost."), _settings.wifi.ssid);
-#endif
     if (_keep_alive)
     {
-#if !defined(__AVR__)
       DEBUG_INFO(F("Attempting reconnection"));
-#endif
     }
 
     return NetworkConnectionState::DISCONNECTED;
@@ -197,6 +335,7 @@ NetworkConnectionState WiFiConnectionHandler::update_handleConnected()
 NetworkConnectionState WiFiConnectionHandler::update_handleDisconnecting()
 {
   WiFi.disconnect();
+  trace(TraceEvent::END);
   return NetworkConnectionState::DISCONNECTED;
 }
 
@@ -215,4 +354,60 @@ NetworkConnectionState WiFiConnectionHandler::update_handleDisconnected()
   }
 }
 
+/******************************************************************************
+  PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+
+int WiFiConnectionHandler::selectProfile()
+{
+  if (_last_good_profile >= 0) {
+    return _last_good_profile;
+  }
+
+  /* Every profile failed once: start over from the preferred ones */
+  uint32_t const all = _profiles_count < 32 ? (1UL << _profiles_count) - 1 : 0xFFFFFFFFUL;
+  if ((_failed_profiles & all) == all) {
+    _failed_profiles = 0;
+  }
+
+  int best = -1;
+  int32_t best_rssi = 0;
+
+#if !defined(ARDUINO_ARCH_ZEPHYR)
+  int const found = WiFi.scanNetworks();
+  trace(TraceEvent::SCAN, found);
+
+  for (int i = 0; i < found; i++) {
+    String const ssid = WiFi.SSID(i);
+    int32_t const rssi = WiFi.RSSI(i);
+
+    for (size_t p = 0; p < _profiles_count; p++) {
+      if (ssid != _profiles[p].wifi.ssid || (_failed_profiles & (1UL << p))) {
+        continue;
+      }
+      if (best < 0 || _profiles[p].priority > _profiles[best].priority ||
+          (_profiles[p].priority == _profiles[best].priority && rssi > best_rssi)) {
+        best = p;
+        best_rssi = rssi;
+      }
+    }
+  }
+#endif
+
+  if (best >= 0) {
+    DEBUG_INFO(F("Selected \"%s\", RSSI %d dBm"), _profiles[best].wifi.ssid, static_cast<int>(best_rssi));
+    return best;
+  }
+
+  /* None visible, possibly hidden: try the next profile in turn not failed yet */
+  int const count = static_cast<int>(_profiles_count);
+  for (int n = 1; n <= count; n++) {
+    int const p = (_profile + n) % count;
+    if (!(_failed_profiles & (1UL << p))) {
+      return p;
+    }
+  }
+  return (_profile + 1) % count;
+}
+
 #endif /* #ifdef BOARD_HAS_WIFI */
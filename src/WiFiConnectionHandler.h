@@ -51,6 +51,22 @@
   #error "Board doesn't support WIFI"
 #endif
 
+/******************************************************************************
+  CONSTANTS
+ ******************************************************************************/
+
+#ifndef CONNECTION_HANDLER_WIFI_MAX_PROFILES
+  #if defined(__AVR__)
+    #define CONNECTION_HANDLER_WIFI_MAX_PROFILES 2
+  #else
+    #define CONNECTION_HANDLER_WIFI_MAX_PROFILES 4
+  #endif
+#endif
+
+#if CONNECTION_HANDLER_WIFI_MAX_PROFILES > 32
+  #error "CONNECTION_HANDLER_WIFI_MAX_PROFILES can't be larger than 32"
+#endif
+
 /******************************************************************************
   CLASS DECLARATION
  ******************************************************************************/
@@ -69,8 +85,37 @@ class WiFiConnectionHandler : public ConnectionHandler
     virtual Client & getClient() override { return _wifi_client; }
     virtual UDP & getUDP() override { return _wifi_udp; }
 
+#if defined(ARDUINO_ARCH_ESP8266)
+    /* TLS connection resuming the session kept in the cache given with
+     * setTLSSessionCache(), if any, with an abbreviated handshake. The session
+     * negotiated by a full handshake is stored for the next connection.
+     */
+    int connectSecure(BearSSL::WiFiClientSecure & client, const char * host, uint16_t const port);
+#endif
+
+    /* Network profiles: when any is added the handler connects to the visible network
+     * with the highest priority, then the strongest one, found by a single scan. The
+     * profile which connected is reused on the next reconnections without scanning,
+     * until it fails. A profile which failed is skipped by the next selections,
+     * falling back to the lower priority and the hidden networks, never found by a
+     * scan and tried in turn, until every profile has failed once.
+     * The profiles take precedence over the SSID and password of the settings.
+     */
+    bool addProfile(char const * ssid, char const * pass, uint8_t const priority = 0);
+    inline void clearProfiles() { _profiles_count = 0; _profile = -1; _last_good_profile = -1; _failed_profiles = 0; }
+    inline size_t getProfilesCount() const { return _profiles_count; }
+    /* Index of the profile in use, -1 if none */
+    inline int getActiveProfile() const { return _profile; }
+
   protected:
 
+    virtual int hostByName(const char * host, IPAddress & ip, IPFamily const family) override;
+    virtual int icmpRTT(IPAddress const & ip) override;
+    virtual int linkQuality() override;
+#if defined(ARDUINO_ARCH_MBED) || defined(ARDUINO_ARCH_ESP32)
+    virtual int connectTimeout(Client & client, IPAddress const & ip, uint16_t const port, unsigned long const timeout) override;
+#endif
+
     virtual NetworkConnectionState update_handleInit         () override;
     virtual NetworkConnectionState update_handleConnecting   () override;
     virtual NetworkConnectionState update_handleConnected    () override;
@@ -78,8 +123,23 @@ class WiFiConnectionHandler : public ConnectionHandler
     virtual NetworkConnectionState update_handleDisconnected () override;
 
   private:
+
+    int selectProfile();
+
+    models::WiFiProfile _profiles[CONNECTION_HANDLER_WIFI_MAX_PROFILES];
+    size_t _profiles_count = 0;
+    int _profile = -1;
+    int _last_good_profile = -1;
+    uint32_t _failed_profiles = 0;  /* bit i set once profile i failed to connect */
+
     WiFiUDP _wifi_udp;
     WiFiClient _wifi_client;
+#if defined(ARDUINO_ARCH_ESP8266)
+    BearSSL::Session _tls_session;
+#endif
+
+    SocketPool<Client, WiFiClient, CONNECTION_HANDLER_CLIENT_POOL_SIZE> _wifi_client_pool;
+    SocketPool<UDP, WiFiUDP, CONNECTION_HANDLER_UDP_POOL_SIZE> _wifi_udp_pool;
 };
 
 #endif /* ARDUINO_WIFI_CONNECTION_HANDLER_H_ */
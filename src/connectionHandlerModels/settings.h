@@ -32,6 +32,11 @@ namespace models {
     char ssid[WifiSsidLength];
     char pwd[WifiPwdLength];
   };
+
+  struct WiFiProfile {
+    WiFiSetting wifi;
+    uint8_t     priority;   // Higher is preferred, RSSI breaks the ties
+  };
   #endif //defined(BOARD_HAS_WIFI)
 
   #if defined(BOARD_HAS_ETHERNET)
@@ -64,6 +69,16 @@ namespace models {
   };
   #endif // defined(BOARD_HAS_NB) || defined(BOARD_HAS_GSM) || defined(BOARD_HAS_CATM1_NBIOT) || defined(BOARD_HAS_CELLULAR)
 
+  #if defined(BOARD_HAS_NB) || defined(BOARD_HAS_GSM) || defined(BOARD_HAS_CELLULAR) || defined(BOARD_HAS_CATM1_NBIOT)
+  struct CellularProfile {
+    char    pin[CellularPinLength];
+    char    apn[CellularApnLength];
+    char    login[CellularLoginLength];
+    char    pass[CellularPassLength];
+    uint8_t sim;                                // SIM slot, 0 on single SIM boards
+  };
+  #endif
+
   #if defined(BOARD_HAS_GSM)
   typedef CellularSetting GSMSetting;
   #endif //defined(BOARD_HAS_GSM)